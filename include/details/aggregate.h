@@ -6,147 +6,643 @@
 #endif
 
 
-inline auto count() {
+namespace details_ {
+
+template<class Cursor, class=void>
+struct is_sliceable : std::false_type {
+};
+
+
+template<class Cursor>
+struct is_sliceable<Cursor, decltype(void(std::declval<const Cursor &>().slice(0, 0)), void(std::declval<const Cursor &>().remaining()))> : std::true_type {
+};
+
+
+template<class Cursor, class=void>
+struct is_contiguous : std::false_type {
+};
+
+
+template<class Cursor>
+struct is_contiguous<Cursor, decltype(void(std::declval<const Cursor &>().data()))> : std::true_type {
+};
+
+
+// Runs partial over the elements at [first, last) of c: as a pointer range
+// when c is contiguous, otherwise through a slice of c.
+template<class Cursor, class Partial>
+inline auto reduce_slice(const Cursor &c, std::size_t first, std::size_t last, Partial &partial, bool leading)
+      -> std::enable_if_t<is_contiguous<Cursor>::value, decltype(partial(c.data(), c.data(), leading))> {
+   const auto *p = c.data();
+   return partial(p + first, p + last, leading);
+}
+
+
+template<class Cursor, class Partial>
+inline auto reduce_slice(const Cursor &c, std::size_t first, std::size_t last, Partial &partial, bool leading)
+      -> std::enable_if_t<!is_contiguous<Cursor>::value, decltype(partial(cursor_iterator<decltype(c.slice(0, 0))>{}, cursor_iterator<decltype(c.slice(0, 0))>{}, leading))> {
+   typedef decltype(c.slice(0, 0)) slice_type;
+
+   slice_type slice = c.slice(first, last);
+   return partial(cursor_iterator<slice_type>{&slice}, cursor_iterator<slice_type>{}, leading);
+}
+
+
+// Total of the elements of a slice, the first one starting from init and the
+// others from their own first element.
+template<class T, class Iterator, class Add>
+inline T sum_slice(Iterator i, Iterator e, const T &init, Add &add, bool leading, std::true_type) {
+   if (leading) {
+      return sum_range(i, e, init, add);
+   }
+   T first = *i;
+   return sum_range(++i, e, std::move(first), add);
+}
+
+
+// Only ever called for the single, leading slice.
+template<class T, class Iterator, class Add>
+inline T sum_slice(Iterator i, Iterator e, const T &init, Add &add, bool, std::false_type) {
+   return sum_range(i, e, init, add);
+}
+
+
+// Applies partial(begin, end, leading) to the remaining elements of s and
+// returns its result.  When s is a fused sequence over random-access storage,
+// the elements are instead split into policy.tasks_for(n) slices reduced
+// concurrently (leading is only true for the first slice), and the partial
+// results are folded in order with combine.  Contiguous storage is handed to
+// partial as pointers, so that it can use the kernels in simd.h.
+template<class Cursor, class Partial, class Combine>
+inline auto reduce(fused_sequence<Cursor> &s, const parallel_policy &policy, Partial partial, Combine combine)
+      -> std::enable_if_t<is_sliceable<Cursor>::value, decltype(reduce_slice(s.cursor(), 0, 0, partial, true))> {
+   typedef decltype(reduce_slice(s.cursor(), 0, 0, partial, true)) result_type;
+
+   const Cursor &c = s.cursor();
+   const std::size_t n = c.remaining();
+   const std::size_t tasks = policy.tasks_for(n);
+   if (tasks < 2) {
+      return reduce_slice(c, 0, n, partial, true);
+   }
+
+   std::vector<std::size_t> bounds = partition_bounds(n, tasks);
+   std::vector<boost::optional<result_type>> partials(tasks);
+   parallel_for(policy, tasks, [&](std::size_t i) {
+         partials[i] = reduce_slice(c, bounds[i], bounds[i + 1], partial, i == 0);
+      });
+
+   result_type result = std::move(*partials[0]);
+   for (std::size_t i = 1; i < tasks; ++i) {
+      result = combine(std::move(result), std::move(*partials[i]));
+   }
+   return result;
+}
+
+
+template<class Sequence, class Partial, class Combine>
+inline auto reduce(Sequence &s, const parallel_policy &, Partial partial, Combine) {
    using std::begin;
    using std::end;
+
+   return partial(begin(s), end(s), true);
+}
+
+}
+
+
+// Aggregates taking a parallel_policy split fused sequences over random-access
+// storage (from(container), from(begin, end), range over integers) across
+// threads.  Their operations must then be associative.
+inline auto count(const parallel_policy &policy) {
    using std::distance;
-   return sequence_manipulator([](sequence<auto> s) mutable {
-         return static_cast<std::size_t>(distance(begin(s), end(s)));
+
+   return sequence_manipulator([=](auto s) mutable {
+         if (auto n = s.remaining()) {
+            return *n;
+         }
+         return details_::reduce(s, policy, [](auto i, auto e, bool) {
+               return static_cast<std::size_t>(distance(i, e));
+            }, std::plus<std::size_t>{});
+      });
+}
+
+
+inline auto count() {
+   return count(sequential());
+}
+
+
+template<class Predicate>
+inline auto count(Predicate p, const parallel_policy &policy) {
+   return sequence_manipulator([=](auto s) mutable {
+         return details_::reduce(s, policy, [&](auto i, auto e, bool) {
+               return details_::count_range(i, e, p);
+            }, std::plus<std::size_t>{});
       });
 }
 
 
 template<class Predicate>
 inline auto count(Predicate p) {
-   using std::begin;
-   using std::end;
-   using std::count_if;
-   return sequence_manipulator([=](sequence<auto> s) mutable {
-         return count_if(begin(s), end(s), p);
+   return count(std::move(p), sequential());
+}
+
+
+template<class Comp>
+inline auto max(Comp comp, const parallel_policy &policy) {
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+
+         return details_::reduce(s, policy, [&](auto i, auto e, bool) {
+               if (i == e) {
+                  throw std::range_error("Min/Max cannot be computed on empty sequence.");
+               }
+               return details_::max_range(i, e, comp);
+            }, [&](S l, S r) { return comp(l, r) ? r : l; });
       });
 }
 
 
-template<class Comp=std::less<void>>
+template<class Comp=std::less<void>, class=std::enable_if_t<!std::is_same<std::decay_t<Comp>, parallel_policy>::value>>
 inline auto max(Comp &&comp={}) {
-   using std::begin;
-   using std::end;
+   return max(std::forward<Comp>(comp), sequential());
+}
 
-   return sequence_manipulator([comp](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
 
-         auto i = begin(s);
-         auto e = end(s);
-         if (i == e) {
-            throw std::range_error("Min/Max cannot be computed on empty sequence.");
-         }
+inline auto max(const parallel_policy &policy) {
+   return max(std::less<void>{}, policy);
+}
 
-         S result{*i};
-         for (++i; i != e; ++i) {
-            if (comp(result, *i)) {
-               result = *i;
-            }
-         }
 
-         return result;
+template<class Comp>
+inline auto min(Comp comp, const parallel_policy &policy) {
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+
+         return details_::reduce(s, policy, [&](auto i, auto e, bool) {
+               if (i == e) {
+                  throw std::range_error("Min/Max cannot be computed on empty sequence.");
+               }
+               return details_::min_range(i, e, comp);
+            }, [&](S l, S r) { return comp(r, l) ? r : l; });
       });
 }
 
 
-template<class Comp=std::less<void>>
+template<class Comp=std::less<void>, class=std::enable_if_t<!std::is_same<std::decay_t<Comp>, parallel_policy>::value>>
 inline auto min(Comp &&comp={}) {
-   using std::begin;
-   using std::end;
+   return min(std::forward<Comp>(comp), sequential());
+}
 
-   return sequence_manipulator([comp](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
 
-         auto i = begin(s);
-         auto e = end(s);
-         if (i == e) {
-            throw std::range_error("Min/Max cannot be computed on empty sequence.");
-         }
+inline auto min(const parallel_policy &policy) {
+   return min(std::less<void>{}, policy);
+}
 
-         S result{*i};
-         for (++i; i != e; ++i) {
-            if (comp(*i, result)) {
-               result = *i;
-            }
-         }
 
-         return result;
+template<class Comp>
+inline auto minmax(Comp comp, const parallel_policy &policy) {
+   using std::make_pair;
+
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::pair<S, S> result_type;
+
+         return details_::reduce(s, policy, [&](auto i, auto e, bool) {
+               if (i == e) {
+                  throw std::range_error("Min/Max cannot be computed on empty sequence.");
+               }
+               return details_::minmax_range(i, e, comp);
+            }, [&](result_type l, result_type r) {
+               return make_pair(comp(r.first, l.first) ? r.first : l.first, comp(l.second, r.second) ? r.second : l.second);
+            });
       });
 }
 
 
-template<class Comp=std::less<void>>
+template<class Comp=std::less<void>, class=std::enable_if_t<!std::is_same<std::decay_t<Comp>, parallel_policy>::value>>
 inline auto minmax(Comp &&comp={}) {
-   using std::begin;
-   using std::end;
-   using std::make_pair;
+   return minmax(std::forward<Comp>(comp), sequential());
+}
 
-   return sequence_manipulator([comp](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
 
-         auto i = begin(s);
-         auto e = end(s);
-         if (i == e) {
-            throw std::range_error("Min/Max cannot be computed on empty sequence.");
-         }
+inline auto minmax(const parallel_policy &policy) {
+   return minmax(std::less<void>{}, policy);
+}
 
-         S min_result{*i};
-         S max_result{*i};
-         for (++i; i != e; ++i) {
-            if (comp(*i, min_result)) {
-               min_result = *i;
-            }
-            else if (comp(max_result, *i)) {
-               max_result = *i;
-            }
-         }
 
-         return make_pair(min_result, max_result);
+// In parallel, every slice but the first is folded starting from its own
+// first element implicitly converted to T, and the slices' totals are then
+// folded with add; no identity of add is needed.  Elements that do not
+// convert to T are summed sequentially whatever the policy.
+template<class T, class Add>
+inline auto sum(T init, Add add, const parallel_policy &policy) {
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::is_convertible<const S &, T> splits;
+
+         return details_::reduce(s, splits::value ? policy : sequential(), [&](auto i, auto e, bool leading) {
+               return details_::sum_slice(i, e, init, add, leading, splits{});
+            }, [&](T l, T r) { return add(l, r); });
       });
 }
 
 
 template<class T, class Add=std::plus<void>>
 inline auto sum(T init={}, Add &&add=Add{}) {
-   using std::begin;
-   using std::end;
-   using std::accumulate;
+   return sum(init, std::forward<Add>(add), sequential());
+}
 
-   return sequence_manipulator([=](sequence<auto> s) mutable {
-         return accumulate(begin(s), end(s), init, add);
+
+template<class Add, class Divide>
+inline auto avg(Add add, Divide divide, const parallel_policy &policy) {
+   using std::make_pair;
+
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::pair<S, S> total_type;
+
+         total_type total = details_::reduce(s, policy, [&](auto i, auto e, bool) {
+               if (i == e) {
+                  throw std::domain_error("Cannot compute average on empty sequence.");
+               }
+
+               S den{1};
+               S num{*i};
+               for (++i; i != e; ++i) {
+                  num = add(num, *i);
+                  den += S{1};
+               }
+               return make_pair(num, den);
+            }, [&](total_type l, total_type r) {
+               l.second += r.second;
+               return make_pair(add(l.first, r.first), l.second);
+            });
+
+         return divide(total.first, total.second);
       });
 }
 
 
 template<class Add=std::plus<void>, class Divide=std::divides<void>>
 inline auto avg(Add &&add={}, Divide &&divide={}) {
-   using std::begin;
-   using std::end;
+   return avg(std::forward<Add>(add), std::forward<Divide>(divide), sequential());
+}
 
-   return sequence_manipulator([=](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
 
-         auto i = begin(s);
-         auto e = end(s);
-         if (i == e) {
-            throw std::domain_error("Cannot compute average on empty sequence.");
+// Accumulators are the building blocks of aggregate().  Each one's start<S>()
+// makes a state, referring to the accumulator, that is fed the first element
+// of a run through first() and every later one through add(), and yields its
+// value with result().  States of consecutive runs are folded with merge(),
+// so accumulators also work with a parallel_policy, under the same
+// associativity requirement as the aggregates above.
+namespace details_ {
+
+class counting_accumulator {
+public:
+   template<class S>
+   class state {
+   public:
+      inline void first(const S &) {
+         n = 1;
+      }
+
+      inline void add(const S &) {
+         ++n;
+      }
+
+      inline void merge(state &&r) {
+         n += r.n;
+      }
+
+      inline std::size_t result() const {
+         return n;
+      }
+
+   private:
+      std::size_t n = 0;
+   };
+
+   template<class S>
+   inline state<S> start(bool) const {
+      return state<S>{};
+   }
+};
+
+
+// Keeps the element e for which keep(e, current) holds; with a less-than
+// comparer, the minimum (keep = comp) or maximum (keep = reversed comp).
+template<class Keep>
+class extreme_accumulator {
+public:
+   explicit inline extreme_accumulator(Keep keep) :
+      keep(std::move(keep))
+   {
+   }
+
+   template<class S>
+   class state {
+   public:
+      explicit inline state(const Keep &keep) :
+         keep(&keep)
+      {
+      }
+
+      inline void first(const S &s) {
+         value = s;
+      }
+
+      inline void add(const S &s) {
+         if ((*keep)(s, *value)) {
+            value = s;
          }
+      }
 
-         S den{1};
-         S num{*i};
-         for (++i; i != e; ++i) {
-            num = add(num, *i);
-            den += S{1};
+      inline void merge(state &&r) {
+         if (!value || (r.value && (*keep)(*r.value, *value))) {
+            value = std::move(r.value);
          }
-         return divide(num, den);
+      }
+
+      inline S result() const {
+         if (!value) {
+            throw std::range_error("Min/Max cannot be computed on empty sequence.");
+         }
+         return *value;
+      }
+
+   private:
+      const Keep *keep;
+      boost::optional<S> value;
+   };
+
+   template<class S>
+   inline state<S> start(bool) const {
+      return state<S>{keep};
+   }
+
+private:
+   Keep keep;
+};
+
+
+template<class Comp>
+class greater_of {
+public:
+   explicit inline greater_of(Comp comp) :
+      comp(std::move(comp))
+   {
+   }
+
+   template<class L, class R>
+   inline bool operator()(const L &l, const R &r) const {
+      return comp(r, l);
+   }
+
+private:
+   Comp comp;
+};
+
+
+template<class T, class Add>
+class summing_accumulator {
+public:
+   inline summing_accumulator(T init, Add add) :
+      init(std::move(init)),
+      add(std::move(add))
+   {
+   }
+
+   // Runs after the first start from their first element converted to T,
+   // as sum() does (see splits_runs).
+   template<class S>
+   class state {
+   public:
+      inline state(const T &total, const Add &plus, bool leading) :
+         total(total),
+         plus(&plus),
+         leading{leading}
+      {
+      }
+
+      inline void first(const S &s) {
+         total = leading ? (*plus)(total, s) : seed(s, std::is_convertible<const S &, T>{});
+      }
+
+      inline void add(const S &s) {
+         total = (*plus)(total, s);
+      }
+
+      inline void merge(state &&r) {
+         total = (*plus)(total, r.total);
+      }
+
+      inline T result() const {
+         return total;
+      }
+
+   private:
+      inline T seed(const S &s, std::true_type) const {
+         return s;
+      }
+
+      inline T seed(const S &s, std::false_type) const {
+         return (*plus)(total, s);
+      }
+
+      T total;
+      const Add *plus;
+      bool leading;
+   };
+
+   template<class S>
+   inline state<S> start(bool leading) const {
+      return state<S>{init, add, leading};
+   }
+
+private:
+   T init;
+   Add add;
+};
+
+
+template<class Add, class Divide>
+class averaging_accumulator {
+public:
+   inline averaging_accumulator(Add add, Divide divide) :
+      add(std::move(add)),
+      divide(std::move(divide))
+   {
+   }
+
+   template<class S>
+   class state {
+   public:
+      inline state(const Add &plus, const Divide &divide) :
+         plus(&plus),
+         divide(&divide)
+      {
+      }
+
+      inline void first(const S &s) {
+         num = s;
+         den = S{1};
+      }
+
+      inline void add(const S &s) {
+         num = (*plus)(*num, s);
+         den += S{1};
+      }
+
+      inline void merge(state &&r) {
+         if (!num) {
+            num = std::move(r.num);
+            den = r.den;
+         }
+         else if (r.num) {
+            num = (*plus)(*num, *r.num);
+            den += r.den;
+         }
+      }
+
+      inline auto result() const {
+         if (!num) {
+            throw std::domain_error("Cannot compute average on empty sequence.");
+         }
+         return (*divide)(*num, den);
+      }
+
+   private:
+      const Add *plus;
+      const Divide *divide;
+      boost::optional<S> num;
+      S den{};
+   };
+
+   template<class S>
+   inline state<S> start(bool) const {
+      return state<S>{add, divide};
+   }
+
+private:
+   Add add;
+   Divide divide;
+};
+
+
+// Whether the states of an accumulator's later runs can be started without
+// the previous runs' results, so that aggregate() can split its input.
+template<class Accumulator, class S>
+struct splits_runs : std::true_type {
+};
+
+
+template<class T, class Add, class S>
+struct splits_runs<summing_accumulator<T, Add>, S> : std::is_convertible<const S &, T> {
+};
+
+
+template<class S, class... Accumulators>
+constexpr bool all_split_runs() {
+   bool all = true;
+   for (bool splits : {true, splits_runs<Accumulators, S>::value...}) {
+      all = all && splits;
+   }
+   return all;
+}
+
+
+template<class S, class Iterator, class Accumulators, std::size_t... I>
+inline auto accumulate_range(Iterator i, Iterator e, bool leading, const Accumulators &accumulators, std::index_sequence<I...>) {
+   auto states = std::make_tuple(std::get<I>(accumulators).template start<S>(leading)...);
+   if (i == e) {
+      return states;
+   }
+
+   {
+      const S &s = *i;
+      (void)std::initializer_list<int>{(std::get<I>(states).first(s), 0)...};
+   }
+   for (++i; i != e; ++i) {
+      const S &s = *i;
+      (void)std::initializer_list<int>{(std::get<I>(states).add(s), 0)...};
+   }
+   return states;
+}
+
+
+template<class States, std::size_t... I>
+inline States merge_states(States l, States r, std::index_sequence<I...>) {
+   (void)std::initializer_list<int>{(std::get<I>(l).merge(std::move(std::get<I>(r))), 0)...};
+   return l;
+}
+
+
+template<class States, std::size_t... I>
+inline auto results_of(const States &states, std::index_sequence<I...>) {
+   return std::make_tuple(std::get<I>(states).result()...);
+}
+
+}
+
+
+inline auto counting() {
+   return details_::counting_accumulator{};
+}
+
+
+template<class Comp=std::less<void>>
+inline auto minimum(Comp comp={}) {
+   return details_::extreme_accumulator<Comp>{std::move(comp)};
+}
+
+
+template<class Comp=std::less<void>>
+inline auto maximum(Comp comp={}) {
+   return details_::extreme_accumulator<details_::greater_of<Comp>>{details_::greater_of<Comp>{std::move(comp)}};
+}
+
+
+template<class T, class Add=std::plus<void>>
+inline auto summing(T init={}, Add add={}) {
+   return details_::summing_accumulator<T, Add>{std::move(init), std::move(add)};
+}
+
+
+template<class Add=std::plus<void>, class Divide=std::divides<void>>
+inline auto averaging(Add add={}, Divide divide={}) {
+   return details_::averaging_accumulator<Add, Divide>{std::move(add), std::move(divide)};
+}
+
+
+// Feeds every element to all accumulators in a single traversal and returns
+// a tuple of their results, e.g.
+// `s | aggregate(counting(), minimum(), maximum(), summing(0), averaging())`.
+// Runs sequentially whatever the policy when a summing() accumulator's
+// elements do not convert to its total (see sum()).
+template<class... Accumulators>
+inline auto aggregate(const parallel_policy &policy, Accumulators... accumulators) {
+   return sequence_manipulator([=, accumulators=std::make_tuple(std::move(accumulators)...)](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::index_sequence_for<Accumulators...> indices;
+
+         const bool splits = details_::all_split_runs<S, Accumulators...>();
+         auto states = details_::reduce(s, splits ? policy : sequential(), [&](auto i, auto e, bool leading) {
+               return details_::accumulate_range<S>(i, e, leading, accumulators, indices{});
+            }, [](auto l, auto r) {
+               return details_::merge_states(std::move(l), std::move(r), indices{});
+            });
+         return details_::results_of(states, indices{});
       });
 }
 
 
+template<class... Accumulators>
+inline auto aggregate(Accumulators... accumulators) {
+   return aggregate(sequential(), std::move(accumulators)...);
+}
+
+
 template<class T, class R, class Add=std::plus<void>, class Multiply=std::multiplies<void>>
 inline auto inner_product(sequence<R> r, T init={}, Add &&add={}, Multiply &&multiply={}) {
    using std::begin;
@@ -154,7 +650,7 @@ inline auto inner_product(sequence<R> r, T init={}, Add &&add={}, Multiply &&mul
    using std::inner_product;
    using std::move;
 
-   return sequence_manipulator([r=move(r), init, add, multiply](sequence<auto> l) mutable {
+   return sequence_manipulator([r=move(r), init, add, multiply](auto l) mutable {
          return inner_product(begin(l), end(l), begin(r), init, add, multiply);
       });
 }
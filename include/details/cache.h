@@ -0,0 +1,419 @@
+#ifndef SEQUENCE_CACHE_H__
+#define SEQUENCE_CACHE_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+
+namespace details_ {
+
+// Elements recorded from a single upstream traversal, shared by every replay.
+// Elements are kept in fixed-size chunks that never move once filled, so
+// replays only synchronize when they step onto a chunk not yet read from the
+// upstream; the replay furthest ahead fills it for everyone.
+template<class T, class Alloc>
+class replay_buffer {
+public:
+   typedef std::vector<T, typename Alloc::template rebind<T>::other> chunk_type;
+
+   inline replay_buffer(sequence<T> &&s, std::size_t chunk_size, std::size_t max_bytes, const Alloc &alloc) :
+      upstream{std::move(s)},
+      chunk_size{chunk_size},
+      max_chunks{max_bytes == 0 ? std::numeric_limits<std::size_t>::max() : std::max<std::size_t>(max_bytes / (chunk_size * sizeof(T)), 1)},
+      alloc(alloc),
+      exhausted{false}
+   {
+   }
+
+   inline std::size_t elements_per_chunk() const noexcept {
+      return chunk_size;
+   }
+
+   // Chunk n, once it is completely filled or the upstream has ended within
+   // it; nullptr if the upstream ended before it.  An exception thrown by the
+   // upstream is rethrown to every replay reaching the chunk it was thrown in.
+   inline const chunk_type * chunk(std::size_t n) {
+      std::lock_guard<std::mutex> lock{mutex};
+
+      while (chunks.size() <= n && !exhausted) {
+         if (error) {
+            std::rethrow_exception(error);
+         }
+         fill();
+      }
+      return n < chunks.size() ? &chunks[n] : nullptr;
+   }
+
+private:
+   inline void fill() {
+      if (!started) {
+         started = true;
+         position = upstream.begin();
+      }
+      if (position == upstream.end()) {
+         exhausted = true;
+         return;
+      }
+      if (chunks.size() == max_chunks) {
+         throw std::length_error("Cached sequence exceeds its memory cap.");
+      }
+
+      // Only complete chunks are published: replays take a short chunk for
+      // the end of the elements.
+      chunk_type c{typename chunk_type::allocator_type{alloc}};
+      c.reserve(chunk_size);
+      try {
+         for (; c.size() < chunk_size && position != upstream.end(); ++position) {
+            c.push_back(*position);
+         }
+      }
+      catch (...) {
+         error = std::current_exception();
+         throw;
+      }
+      exhausted = c.size() < chunk_size;
+      chunks.push_back(std::move(c));
+   }
+
+   std::mutex mutex;
+   sequence<T> upstream;
+   typename sequence<T>::iterator position;
+   std::size_t chunk_size;
+   std::size_t max_chunks;
+   Alloc alloc;
+   std::deque<chunk_type> chunks;
+   std::exception_ptr error;
+   bool started = false;
+   bool exhausted;
+};
+
+
+template<class T, class Alloc>
+class replay_cursor {
+public:
+   typedef T value_type;
+
+   explicit inline replay_cursor(std::shared_ptr<replay_buffer<T, Alloc>> b) :
+      buffer{std::move(b)},
+      n{0}
+   {
+      load();
+   }
+
+   inline bool done() const {
+      return i == e;
+   }
+
+   inline const T & current() const {
+      return *i;
+   }
+
+   inline void advance() {
+      if (++i == e && e == full) {
+         ++n;
+         load();
+      }
+   }
+
+private:
+   inline void load() {
+      const auto *c = buffer->chunk(n);
+      i = c ? c->data() : nullptr;
+      e = c ? c->data() + c->size() : nullptr;
+      full = c ? c->data() + buffer->elements_per_chunk() : nullptr;
+   }
+
+   std::shared_ptr<replay_buffer<T, Alloc>> buffer;
+   std::size_t n;
+   const T *i;
+   const T *e;
+   const T *full;
+};
+
+}
+
+
+// Result of cache(): each traversal replays the upstream's elements from the
+// start, reading the upstream only once.  Replays may be interleaved and may
+// run on different threads.
+template<class T, class Alloc=std::allocator<void>>
+class cached_sequence {
+public:
+   typedef T value_type;
+   typedef fused_sequence<details_::replay_cursor<T, Alloc>> replay_type;
+
+   explicit inline cached_sequence(std::shared_ptr<details_::replay_buffer<T, Alloc>> b, const Alloc &alloc) :
+      buffer{std::move(b)},
+      alloc(alloc)
+   {
+   }
+
+   // A new traversal from the first element.
+   inline replay_type replay() const {
+      return details_::fuse(alloc, details_::replay_cursor<T, Alloc>{buffer});
+   }
+
+private:
+   std::shared_ptr<details_::replay_buffer<T, Alloc>> buffer;
+   Alloc alloc;
+};
+
+
+template<class T, class Alloc, class Op>
+inline auto operator|(const cached_sequence<T, Alloc> &c, sequence_operation<Op> sop) {
+   using std::move;
+
+   return c.replay() | move(sop);
+}
+
+
+// Records elements in chunks of chunk_size (by default about 64 KB worth) as
+// they are first read.  If max_bytes is non-zero, a replay reaching past the
+// chunks that fit in it throws std::length_error rather than recording more;
+// the chunks recorded so far stay intact, and every later replay that goes as
+// far throws again.  Likewise an exception thrown by the upstream is rethrown
+// to every replay reaching the chunk it was thrown in.
+template<class Alloc=std::allocator<void>>
+inline auto cache(std::size_t chunk_size=0, std::size_t max_bytes=0, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef details_::replay_buffer<S, Alloc> buffer_type;
+
+         const std::size_t elements = chunk_size != 0 ? chunk_size : std::max<std::size_t>((64 * 1024) / sizeof(S), 1);
+         sequence<S> upstream = move(s);
+         return cached_sequence<S, Alloc>{std::allocate_shared<buffer_type>(alloc, move(upstream), elements, max_bytes, alloc), alloc};
+      });
+}
+
+
+namespace details_ {
+
+// Upstream shared by the sequences returned from tee().  Elements are kept from
+// the slowest live consumer's position up to the fastest one's, and dropped as
+// soon as every consumer has moved past them.  A consumer with a yield hook
+// (see broadcast) suspends after every `batch` elements it reads from the
+// upstream, so that the others can catch up and the buffer stays short.
+template<class T>
+class tee_state {
+public:
+   typedef typename boost::coroutines::asymmetric_coroutine<void>::push_type yield_type;
+
+   static constexpr std::size_t detached = std::numeric_limits<std::size_t>::max();
+   static constexpr std::size_t batch = 256;
+
+   inline tee_state(sequence<T> &&s, std::size_t consumers) :
+      upstream{std::move(s)},
+      position{upstream.begin()},
+      base{0},
+      positions(consumers, 0),
+      pulled(consumers, 0),
+      yields(consumers, nullptr)
+   {
+   }
+
+   // Element `index` as seen by `consumer`, or nullptr past the end.
+   inline const T * at(std::size_t consumer, std::size_t index) {
+      while (base + buffer.size() <= index) {
+         if (yields[consumer] && pulled[consumer] >= batch) {
+            pulled[consumer] = 0;
+            (*yields[consumer])();
+            continue;
+         }
+         if (position == upstream.end()) {
+            return nullptr;
+         }
+         buffer.push_back(*position);
+         ++position;
+         ++pulled[consumer];
+      }
+      return &buffer[index - base];
+   }
+
+   inline void move_to(std::size_t consumer, std::size_t index) {
+      positions[consumer] = index;
+      trim();
+   }
+
+   inline void detach(std::size_t consumer) {
+      move_to(consumer, detached);
+   }
+
+   inline void set_yield(std::size_t consumer, yield_type *yield) {
+      yields[consumer] = yield;
+   }
+
+   inline std::size_t buffered() const noexcept {
+      return buffer.size();
+   }
+
+private:
+   inline void trim() {
+      const std::size_t slowest = *std::min_element(positions.begin(), positions.end());
+      while (base < slowest && !buffer.empty()) {
+         buffer.pop_front();
+         ++base;
+      }
+   }
+
+   sequence<T> upstream;
+   typename sequence<T>::iterator position;
+   std::deque<T> buffer;
+   std::size_t base;
+   std::vector<std::size_t> positions;
+   std::vector<std::size_t> pulled;
+   std::vector<yield_type *> yields;
+};
+
+
+template<class T>
+constexpr std::size_t tee_state<T>::detached;
+
+
+template<class T>
+constexpr std::size_t tee_state<T>::batch;
+
+
+template<class T>
+class tee_cursor {
+public:
+   typedef T value_type;
+
+   inline tee_cursor(std::shared_ptr<tee_state<T>> s, std::size_t consumer) :
+      state{std::move(s)},
+      consumer{consumer},
+      index{0},
+      value{state->at(consumer, 0)}
+   {
+   }
+
+   inline tee_cursor(tee_cursor &&other) noexcept :
+      state{std::move(other.state)},
+      consumer{other.consumer},
+      index{other.index},
+      value{other.value}
+   {
+   }
+
+   tee_cursor(const tee_cursor &) = delete;
+   tee_cursor & operator =(const tee_cursor &) = delete;
+
+   inline ~tee_cursor() {
+      if (state) {
+         state->detach(consumer);
+      }
+   }
+
+   inline bool done() const {
+      return value == nullptr;
+   }
+
+   inline const T & current() const {
+      return *value;
+   }
+
+   inline void advance() {
+      state->move_to(consumer, ++index);
+      value = state->at(consumer, index);
+   }
+
+private:
+   std::shared_ptr<tee_state<T>> state;
+   std::size_t consumer;
+   std::size_t index;
+   const T *value;
+};
+
+
+template<class T, class Alloc>
+inline auto tee_consumers(std::shared_ptr<tee_state<T>> state, std::size_t n, const Alloc &alloc) {
+   std::vector<fused_sequence<tee_cursor<T>>> consumers;
+   consumers.reserve(n);
+   for (std::size_t i = 0; i < n; ++i) {
+      consumers.push_back(fuse(alloc, tee_cursor<T>{state, i}));
+   }
+   return consumers;
+}
+
+
+template<class S, class... Ops, std::size_t... I>
+inline auto broadcast_to(S s, const stack_attributes &attrs, std::tuple<sequence_operation<Ops>...> &ops, std::index_sequence<I...>) {
+   typedef typename S::value_type T;
+   typedef typename boost::coroutines::asymmetric_coroutine<void>::pull_type coroutine_type;
+   typedef typename boost::coroutines::asymmetric_coroutine<void>::push_type yield_type;
+   typedef fused_sequence<tee_cursor<T>> consumer_type;
+
+   auto state = std::make_shared<tee_state<T>>(sequence<T>{std::move(s)}, sizeof...(I));
+   auto consumers = tee_consumers(state, sizeof...(I), std::allocator<void>{});
+   std::tuple<boost::optional<decltype(std::declval<sequence_operation<Ops> &>()(std::declval<consumer_type>()))>...> results;
+
+   // Every operation runs on its own coroutine, resumed in turn until all of
+   // them have returned.
+   std::vector<coroutine_type> coroutines;
+   coroutines.reserve(sizeof...(I));
+   auto start = [&](auto consumer, auto &op, auto &result) {
+         coroutines.emplace_back([&, consumer](yield_type &yield) {
+               state->set_yield(consumer, &yield);
+               result = op(std::move(consumers[consumer]));
+               state->set_yield(consumer, nullptr);
+            }, attrs, pooled_stack_allocator{});
+      };
+   (void)std::initializer_list<int>{(start(I, std::get<I>(ops), std::get<I>(results)), 0)...};
+
+   for (bool running = true; running;) {
+      running = false;
+      for (auto &coroutine : coroutines) {
+         if (coroutine) {
+            coroutine();
+            running = running || coroutine;
+         }
+      }
+   }
+
+   return std::make_tuple(std::move(*std::get<I>(results))...);
+}
+
+}
+
+
+// n sequences over the same upstream, each yielding all of its elements.  The
+// upstream is read once; elements are buffered only between the slowest and
+// the fastest consumer, so consumers should be advanced roughly in step (or
+// use broadcast).
+template<class Alloc=std::allocator<void>>
+inline auto tee(std::size_t n, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([n, alloc = Alloc(alloc)](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+
+         auto state = std::make_shared<details_::tee_state<S>>(sequence<S>{move(s)}, n);
+         // Handing over a fresh copy keeps GCC from reading the (empty)
+         // captured allocator as maybe-uninitialized at -O2.
+         return details_::tee_consumers(move(state), n, Alloc(alloc));
+      });
+}
+
+
+// Applies each of several operations (typically aggregates) to the whole
+// sequence in a single pass over it, returning their results as a tuple, e.g.
+// `s | broadcast(count(), max(), avg())`.  Each operation runs on a coroutine
+// with the given attributes.
+template<class... Ops>
+inline auto broadcast(const stack_attributes &attrs, sequence_operation<Ops>... ops) {
+   using std::move;
+
+   return sequence_manipulator([attrs, ops=std::make_tuple(move(ops)...)](auto s) mutable {
+         return details_::broadcast_to(move(s), attrs, ops, std::index_sequence_for<Ops...>{});
+      });
+}
+
+
+template<class... Ops>
+inline auto broadcast(sequence_operation<Ops>... ops) {
+   return broadcast(default_stack(), std::move(ops)...);
+}
+
+#endif
@@ -20,6 +20,444 @@ template<class T>
 inline void check_delta(T, std::false_type) noexcept {
 }
 
+
+template<class Iterator>
+using random_access_only = std::enable_if_t<std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>::value>;
+
+
+// std::basic_string is only instantiated for character types, since naming
+// basic_string<T> for any other T is ill-formed (and rejected by libc++).
+template<class Iterator, class T,
+         bool=std::is_same<T, char>::value || std::is_same<T, wchar_t>::value ||
+              std::is_same<T, char16_t>::value || std::is_same<T, char32_t>::value>
+struct is_string_iterator : std::false_type {
+};
+
+
+template<class Iterator, class T>
+struct is_string_iterator<Iterator, T, true> :
+   std::integral_constant<bool, std::is_same<Iterator, typename std::basic_string<T>::iterator>::value ||
+                                std::is_same<Iterator, typename std::basic_string<T>::const_iterator>::value> {
+};
+
+
+template<class Iterator, class T=typename std::iterator_traits<Iterator>::value_type>
+using contiguous_only = std::enable_if_t<std::is_pointer<Iterator>::value ||
+                                         std::is_same<Iterator, typename std::vector<T>::iterator>::value ||
+                                         std::is_same<Iterator, typename std::vector<T>::const_iterator>::value ||
+                                         is_string_iterator<Iterator, T>::value>;
+
+
+// Cursors over random-access storage also provide remaining(), advance(n) and
+// slice(first, last), a cursor over the elements at positions [first, last)
+// counted from the current one, so that reductions can split them up.  Over
+// contiguous storage they provide data(), a pointer to the current element,
+// letting reductions run on plain arrays.
+template<class Iterator, bool=std::is_lvalue_reference<typename std::iterator_traits<Iterator>::reference>::value>
+class iterator_cursor {
+public:
+   typedef typename std::iterator_traits<Iterator>::value_type value_type;
+
+   inline iterator_cursor(Iterator b, Iterator e) :
+      i{b},
+      e{e}
+   {
+   }
+
+   inline bool done() const {
+      return i == e;
+   }
+
+   inline const value_type & current() const {
+      return *i;
+   }
+
+   inline void advance() {
+      ++i;
+   }
+
+   template<class I=Iterator, class=random_access_only<I>>
+   inline std::size_t remaining() const {
+      return static_cast<std::size_t>(e - i);
+   }
+
+   template<class I=Iterator, class=random_access_only<I>>
+   inline void advance(std::size_t n) {
+      i += n;
+   }
+
+   template<class I=Iterator, class=random_access_only<I>>
+   inline iterator_cursor slice(std::size_t first, std::size_t last) const {
+      return iterator_cursor{i + first, i + last};
+   }
+
+   template<class I=Iterator, class=contiguous_only<I>>
+   inline const value_type * data() const {
+      return i == e ? nullptr : std::addressof(*i);
+   }
+
+private:
+   Iterator i;
+   Iterator e;
+};
+
+
+// Iterators yielding proxies or temporaries (e.g. std::vector<bool>) need the
+// current element kept alive by the cursor.
+template<class Iterator>
+class iterator_cursor<Iterator, false> {
+public:
+   typedef typename std::iterator_traits<Iterator>::value_type value_type;
+
+   inline iterator_cursor(Iterator b, Iterator e) :
+      i{b},
+      e{e}
+   {
+      fetch();
+   }
+
+   inline bool done() const {
+      return i == e;
+   }
+
+   inline const value_type & current() const {
+      return *value;
+   }
+
+   inline void advance() {
+      ++i;
+      fetch();
+   }
+
+   template<class I=Iterator, class=random_access_only<I>>
+   inline std::size_t remaining() const {
+      return static_cast<std::size_t>(e - i);
+   }
+
+   template<class I=Iterator, class=random_access_only<I>>
+   inline void advance(std::size_t n) {
+      i += n;
+      fetch();
+   }
+
+   template<class I=Iterator, class=random_access_only<I>>
+   inline iterator_cursor slice(std::size_t first, std::size_t last) const {
+      return iterator_cursor{i + first, i + last};
+   }
+
+private:
+   inline void fetch() {
+      if (i != e) {
+         value = *i;
+      }
+   }
+
+   Iterator i;
+   Iterator e;
+   boost::optional<value_type> value;
+};
+
+
+// Keeps an rvalue container alive for as long as the sequence iterates it.
+template<class Container>
+class container_cursor {
+   typedef iterator_cursor<typename Container::const_iterator> base_cursor;
+
+public:
+   typedef typename base_cursor::value_type value_type;
+
+   inline container_cursor(std::shared_ptr<const Container> c) :
+      container{std::move(c)},
+      cursor{container->begin(), container->end()}
+   {
+   }
+
+   inline bool done() const {
+      return cursor.done();
+   }
+
+   inline const value_type & current() const {
+      return cursor.current();
+   }
+
+   inline void advance() {
+      cursor.advance();
+   }
+
+   template<class C=base_cursor>
+   inline auto remaining() const -> decltype(std::declval<const C &>().remaining()) {
+      return cursor.remaining();
+   }
+
+   template<class C=base_cursor>
+   inline auto advance(std::size_t n) -> decltype(std::declval<C &>().advance(n)) {
+      cursor.advance(n);
+   }
+
+   // Slices borrow the container from this cursor.
+   template<class C=base_cursor>
+   inline auto slice(std::size_t first, std::size_t last) const -> decltype(std::declval<const C &>().slice(first, last)) {
+      return cursor.slice(first, last);
+   }
+
+   template<class C=base_cursor>
+   inline auto data() const -> decltype(std::declval<const C &>().data()) {
+      return cursor.data();
+   }
+
+private:
+   std::shared_ptr<const Container> container;
+   base_cursor cursor;
+};
+
+
+template<class T>
+class null_terminated_cursor {
+public:
+   typedef T value_type;
+
+   explicit inline null_terminated_cursor(const T *c) :
+      c{c}
+   {
+   }
+
+   inline bool done() const {
+      return !*c;
+   }
+
+   inline const T & current() const {
+      return *c;
+   }
+
+   inline void advance() {
+      ++c;
+   }
+
+private:
+   const T *c;
+};
+
+
+template<class Generator>
+class generate_cursor {
+public:
+   typedef std::result_of_t<Generator()> value_type;
+
+   inline generate_cursor(Generator g, std::size_t n) :
+      generate(std::move(g)),
+      remaining{n}
+   {
+      fetch();
+   }
+
+   inline bool done() const {
+      return remaining == 0;
+   }
+
+   inline const value_type & current() const {
+      return *value;
+   }
+
+   inline void advance() {
+      --remaining;
+      fetch();
+   }
+
+private:
+   inline void fetch() {
+      if (remaining > 0) {
+         value = generate();
+      }
+   }
+
+   Generator generate;
+   std::size_t remaining;
+   boost::optional<value_type> value;
+};
+
+
+template<class T>
+class range_cursor {
+public:
+   typedef T value_type;
+
+   inline range_cursor(T start, T finish, T delta) :
+      value{start},
+      finish{finish},
+      delta{delta},
+      ascending{start < finish}
+   {
+   }
+
+   inline bool done() const {
+      return ascending ? !(value < finish) : !(finish < value);
+   }
+
+   inline const T & current() const {
+      return value;
+   }
+
+   inline void advance() {
+      if (ascending) {
+         value += delta;
+      }
+      else {
+         value -= delta;
+      }
+   }
+
+   template<class U=T, class=std::enable_if_t<std::is_integral<U>::value>>
+   inline std::size_t remaining() const {
+      if (done()) {
+         return 0;
+      }
+      // The distance may not fit in T (e.g. from -100 to 100 in 8 bits).
+      typedef std::make_unsigned_t<T> distance_type;
+      const distance_type distance = ascending ? distance_type(distance_type(finish) - distance_type(value))
+                                               : distance_type(distance_type(value) - distance_type(finish));
+      return static_cast<std::size_t>((distance - 1) / distance_type(delta)) + 1;
+   }
+
+   template<class U=T, class=std::enable_if_t<std::is_integral<U>::value>>
+   inline void advance(std::size_t n) {
+      value = n < remaining() ? at(n) : finish;
+   }
+
+   template<class U=T, class=std::enable_if_t<std::is_integral<U>::value>>
+   inline range_cursor slice(std::size_t first, std::size_t last) const {
+      return range_cursor{at(first), last < remaining() ? at(last) : finish, delta};
+   }
+
+private:
+   // Offsets are computed unsigned too, as they may not fit in T either.
+   inline T at(std::size_t position) const {
+      typedef std::make_unsigned_t<T> offset_type;
+      const offset_type offset = offset_type(offset_type(position) * offset_type(delta));
+      return static_cast<T>(ascending ? offset_type(offset_type(value) + offset) : offset_type(offset_type(value) - offset));
+   }
+
+   T value;
+   T finish;
+   T delta;
+   bool ascending;
+};
+
+
+template<class Left, class Right>
+class zip_cursor {
+public:
+   typedef std::pair<typename Left::value_type, typename Right::value_type> value_type;
+
+   inline zip_cursor(Left &&l, Right &&r) :
+      left(std::move(l)),
+      right(std::move(r))
+   {
+      fetch();
+   }
+
+   inline bool done() const {
+      return left.done() || right.done();
+   }
+
+   inline const value_type & current() const {
+      return *value;
+   }
+
+   inline void advance() {
+      left.advance();
+      right.advance();
+      fetch();
+   }
+
+   template<class L=Left, class R=Right>
+   inline auto remaining() const -> decltype(void(std::declval<const L &>().remaining()), std::declval<const R &>().remaining()) {
+      return std::min(left.remaining(), right.remaining());
+   }
+
+   template<class L=Left, class R=Right>
+   inline auto advance(std::size_t n) -> decltype(std::declval<L &>().advance(n), std::declval<R &>().advance(n)) {
+      left.advance(n);
+      right.advance(n);
+      fetch();
+   }
+
+   // Bounded by whichever side has a bound.
+   inline boost::optional<std::size_t> size_hint() const {
+      auto l = size_hint_of(left);
+      auto r = size_hint_of(right);
+      if (l && r) {
+         return std::min(*l, *r);
+      }
+      return l ? l : r;
+   }
+
+private:
+   inline void fetch() {
+      if (!done()) {
+         value = value_type{left.current(), right.current()};
+      }
+   }
+
+   Left left;
+   Right right;
+   boost::optional<value_type> value;
+};
+
+
+template<class Left, class Right>
+class concat_cursor {
+public:
+   typedef typename Left::value_type value_type;
+
+   inline concat_cursor(Left &&l, Right &&r) :
+      left(std::move(l)),
+      right(std::move(r))
+   {
+   }
+
+   inline bool done() const {
+      return left.done() && right.done();
+   }
+
+   inline const value_type & current() const {
+      return left.done() ? right.current() : left.current();
+   }
+
+   inline void advance() {
+      if (!left.done()) {
+         left.advance();
+      }
+      else {
+         right.advance();
+      }
+   }
+
+   template<class L=Left, class R=Right>
+   inline auto remaining() const -> decltype(std::declval<const L &>().remaining() + std::declval<const R &>().remaining()) {
+      return left.remaining() + right.remaining();
+   }
+
+   template<class L=Left, class R=Right>
+   inline auto advance(std::size_t n) -> decltype(std::declval<L &>().advance(n), std::declval<R &>().advance(n)) {
+      const std::size_t from_left = std::min(n, left.remaining());
+      left.advance(from_left);
+      right.advance(n - from_left);
+   }
+
+   inline boost::optional<std::size_t> size_hint() const {
+      auto l = size_hint_of(left);
+      auto r = size_hint_of(right);
+      if (l && r) {
+         return *l + *r;
+      }
+      return boost::none;
+   }
+
+private:
+   Left left;
+   Right right;
+};
+
 }
 
 
@@ -30,32 +468,28 @@ inline auto empty() {
 
 template<class T>
 inline auto contains(const T &t) {
-   using std::begin;
-   using std::end;
-   using std::find;
-
-   return sequence_manipulator([t](sequence<auto> s) mutable {
-         auto e = end(s);
-         return find(begin(s), e, t) != e;
+   return sequence_manipulator([t](auto s) mutable {
+         return details_::reduce(s, sequential(), [&](auto i, auto e, bool) {
+               return details_::contains_range(i, e, t);
+            }, std::logical_or<bool>{});
       });
 }
 
 
+// Lifetimes: from(b, e), from(container) over an lvalue and from(pointer)
+// borrow their elements, which are read lazily as the sequence is traversed,
+// so the range must outlive the sequence (and any sequence composed from it).
+// In particular a function returning from(local) dangles; pass the local as
+// an rvalue, from(std::move(local)), for the sequence to take ownership of
+// it, as from(container) over an rvalue and from({...}) always do.
 template<class InputIterator, class Alloc=std::allocator<void>>
-inline sequence<typename std::iterator_traits<InputIterator>::value_type> from(InputIterator b, InputIterator e, const Alloc &alloc={}) {
-   using std::for_each;
-   using std::ref;
-
-   typedef sequence<typename std::iterator_traits<InputIterator>::value_type> sequence_type;
-
-   return sequence_type{std::allocator_arg, alloc, [=, i=b](auto &yield) mutable {
-         for_each(b, e, ref(yield));
-      }};
+inline fused_sequence<details_::iterator_cursor<InputIterator>> from(InputIterator b, InputIterator e, const Alloc &alloc={}) {
+   return details_::fuse(alloc, details_::iterator_cursor<InputIterator>{b, e});
 }
 
 
-template<class Container>
-inline sequence<typename Container::value_type> from(Container const &c) {
+template<class Container, class=typename Container::value_type>
+inline fused_sequence<details_::iterator_cursor<typename Container::const_iterator>> from(Container const &c) {
    using std::begin;
    using std::end;
 
@@ -63,89 +497,57 @@ inline sequence<typename Container::value_type> from(Container const &c) {
 }
 
 
-template<class Container>
-inline sequence<typename Container::value_type> from(Container &&c) {
-   using std::begin;
-   using std::end;
+template<class Container, class=typename Container::value_type>
+inline fused_sequence<details_::container_cursor<Container>> from(Container &&c) {
+   using std::move;
 
-   return from(begin(c), end(c), c.get_allocator());
+   auto alloc = c.get_allocator();
+   return details_::fuse(alloc, details_::container_cursor<Container>{std::allocate_shared<const Container>(alloc, move(c))});
 }
 
 
 template<class T, class Alloc=std::allocator<void>>
-inline sequence<T> from(std::initializer_list<T> c, const Alloc &alloc={}) {
-   using std::begin;
-   using std::end;
+inline fused_sequence<details_::container_cursor<std::vector<T, typename Alloc::template rebind<T>::other>>> from(std::initializer_list<T> c, const Alloc &alloc={}) {
+   typedef std::vector<T, typename Alloc::template rebind<T>::other> container_type;
 
-   return from(begin(c), end(c), alloc);
+   return from(container_type(c, typename container_type::allocator_type{alloc}));
 }
 
 
 template<class T, class Alloc=std::allocator<void>>
-inline sequence<T> from(const T *c, const Alloc &alloc={}) {
-   return sequence<T>(std::allocator_arg, alloc, [c] (auto &yield) mutable {
-         for (; *c; ++c) {
-            yield(*c);
-         }
-      });
+inline fused_sequence<details_::null_terminated_cursor<T>> from(const T *c, const Alloc &alloc={}) {
+   return details_::fuse(alloc, details_::null_terminated_cursor<T>{c});
 }
 
 
 template<class Generator, class Alloc=std::allocator<void>>
-static inline sequence<std::result_of_t<Generator()>> generate(Generator generate, std::size_t n, const Alloc &alloc={}) {
-   typedef sequence<std::result_of_t<Generator()>> sequence_type;
+static inline fused_sequence<details_::generate_cursor<Generator>> generate(Generator generate, std::size_t n, const Alloc &alloc={}) {
+   using std::move;
 
-   return sequence_type(std::allocator_arg, alloc, [=](auto &yield) mutable {
-         for (std::size_t i = 0; i < n; ++i) {
-            yield(generate());
-         }
-      });
+   return details_::fuse(alloc, details_::generate_cursor<Generator>{move(generate), n});
 }
 
 
 template<class T, class Alloc=std::allocator<void>>
-inline sequence<T> range(T start, T finish, T delta=1, const Alloc &alloc={}) {
+inline fused_sequence<details_::range_cursor<T>> range(T start, T finish, T delta=1, const Alloc &alloc={}) {
    details_::check_delta(delta, std::is_signed<T>{});
 
-   if (start < finish) {
-      return sequence<T>(std::allocator_arg, alloc, [=](auto &yield) mutable {
-            for (T i = start; i < finish; i += delta) {
-               yield(i);
-            }
-         });
-   }
-   else if (finish < start) {
-      return sequence<T>(std::allocator_arg, alloc, [=](auto &yield) mutable {
-            for (T i = start; i > finish; i -= delta) {
-               yield(i);
-            }
-         });
-   }
-
-   return sequence<T>{};
+   return details_::fuse(alloc, details_::range_cursor<T>{start, finish, delta});
 }
 
 
-template<class R, class Alloc=std::allocator<void>>
-inline auto zip_with(sequence<R> rhs, const Alloc &alloc={}) {
-   using std::begin;
-   using std::end;
+// The right-hand side may be any sequence; a fused one keeps its cursor, and
+// with it its size and random access.
+template<class Rhs, class Alloc=std::allocator<void>, class=std::enable_if_t<std::is_base_of<sequence<typename Rhs::value_type>, Rhs>::value>>
+inline auto zip_with(Rhs rhs, const Alloc &alloc={}) {
    using std::move;
 
-   return sequence_manipulator([alloc, r_=move(rhs)](sequence<auto> l) mutable {
-         typedef typename decltype(l)::value_type L;
-         return sequence<std::pair<L, R>>(std::allocator_arg, alloc, [l=move(l), r=move(r_)](auto &yield) mutable {
-               auto li = begin(l);
-               auto le = end(l);
-               auto ri = begin(r);
-               auto re = end(r);
-
-               while (li != le && ri != re) {
-                  yield({ *li, *ri });
-                  ++li;
-                  ++ri;
-               }
-            });
+   return sequence_manipulator([alloc, r_=move(rhs)](auto l) mutable {
+         auto left = details_::cursor_of(move(l));
+         auto right = details_::cursor_of(move(r_));
+         typedef details_::zip_cursor<decltype(left), decltype(right)> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(left), move(right)});
       });
 }
 
@@ -157,7 +559,7 @@ enum class pairwise_capture {
 
 
 template<class Alloc=std::allocator<void>>
-inline auto pairwise(pairwise_capture capture=pairwise_capture::ignore_remainder, const Alloc &alloc={}) {
+inline auto pairwise(pairwise_capture capture=pairwise_capture::ignore_remainder, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::begin;
    using std::end;
    using std::forward;
@@ -166,7 +568,7 @@ inline auto pairwise(pairwise_capture capture=pairwise_capture::ignore_remainder
    return sequence_manipulator([=](sequence<auto> s) mutable {
          typedef typename decltype(s)::value_type S;
 
-         return sequence<std::pair<S, S>>{std::allocator_arg, alloc, [s=move(s), capture=capture](auto &yield) mutable {
+         return sequence<std::pair<S, S>>{std::allocator_arg, alloc, attrs, [s=move(s), capture=capture](auto &yield) mutable {
                auto i = begin(s);
                auto e = end(s);
 
@@ -186,18 +588,19 @@ inline auto pairwise(pairwise_capture capture=pairwise_capture::ignore_remainder
 }
 
 
-template<class T, class Alloc=std::allocator<void>>
-inline auto concat(sequence<T> rhs, const Alloc &alloc={}) {
-   using std::begin;
-   using std::end;
+template<class Rhs, class Alloc=std::allocator<void>, class=std::enable_if_t<std::is_base_of<sequence<typename Rhs::value_type>, Rhs>::value>>
+inline auto concat(Rhs rhs, const Alloc &alloc={}) {
    using std::move;
 
-   return sequence_manipulator([alloc, r_=move(rhs)](sequence<T> l_) mutable {
-         auto f = [r=move(r_), l=move(l_)](auto &yield) mutable {
-               copy(begin(l), end(l), sink_iterator(yield));
-               copy(begin(r), end(r), sink_iterator(yield));
-            };
-         return sequence<T>{std::allocator_arg, alloc, move(f)};
+   return sequence_manipulator([alloc, r_=move(rhs)](auto l) mutable {
+         static_assert(std::is_same<typename decltype(l)::value_type, typename Rhs::value_type>::value,
+                       "Concatenated sequences must have the same value type.");
+
+         auto left = details_::cursor_of(move(l));
+         auto right = details_::cursor_of(move(r_));
+         typedef details_::concat_cursor<decltype(left), decltype(right)> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(left), move(right)});
       });
 }
 
@@ -55,12 +55,27 @@ inline auto first() {
 }
 
 
+namespace details_ {
+
+// Moves a sequence whose size is known to its last element.
+template<class S>
+inline void seek_last(S &s) {
+   auto n = s.remaining();
+   if (n && *n > 1) {
+      s.advance(*n - 1);
+   }
+}
+
+}
+
+
 inline auto last_or_default() {
    using std::move;
 
    return sequence_manipulator([](sequence<auto> s) {
          typedef typename decltype(s)::value_type S;
 
+         details_::seek_last(s);
          S result = {};
          for (const S &s_value : s) {
             result = s_value;
@@ -80,6 +95,7 @@ inline auto last_or_default(T &&t) {
          typedef typename decltype(s)::value_type S;
          static_assert(std::is_convertible<T, S>::value, "Unable to convert default value type T to sequence value type S.");
 
+         details_::seek_last(s);
          S result{t};
          for (const S &s_value : s) {
             result = s_value;
@@ -96,6 +112,8 @@ inline auto last() {
    using std::move;
 
    return sequence_manipulator([](sequence<auto> s) {
+         details_::seek_last(s);
+
          auto i = begin(s);
          auto e = end(s);
          if (i == e) {
@@ -115,12 +133,9 @@ inline auto element_at_or_default(std::size_t n) {
    return sequence_manipulator([n](sequence<auto> s) mutable {
          typedef typename decltype(s)::value_type S;
 
+         s.advance(n);
          auto i = s.begin();
-         auto e = s.end();
-
-         for (; i != e && n-- > 0; ++i) {}
-
-         return (i == e) ? S{} : *i;
+         return (i == s.end()) ? S{} : *i;
       });
 }
 
@@ -135,12 +150,9 @@ inline auto element_at_or_default(std::size_t n, T &&t) {
          typedef typename decltype(s)::value_type S;
          static_assert(std::is_convertible<T, S>::value, "Unable to convert default value type T to sequence value type S.");
 
+         s.advance(n);
          auto i = begin(s);
-         auto e = end(s);
-
-         for (; i != e && n-- > 0; ++i) {}
-
-         return (i == e) ? S{t} : *i;
+         return (i == end(s)) ? S{t} : *i;
       });
 }
 
@@ -150,12 +162,9 @@ inline auto element_at(std::size_t n) {
    using std::end;
 
    return sequence_manipulator([n](sequence<auto> s) mutable {
+         s.advance(n);
          auto i = begin(s);
-         auto e = end(s);
-
-         for (; i != e && n-- > 0; ++i) {}
-
-         if (i == e) {
+         if (i == end(s)) {
             throw std::range_error("Element at index cannot be retrieved because there aren't enough elements in the sequence.");
          }
 
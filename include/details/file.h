@@ -0,0 +1,273 @@
+#ifndef SEQUENCE_FILE_H__
+#define SEQUENCE_FILE_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+namespace details_ {
+
+inline std::string file_error(const char *what, const std::string &path) {
+   return std::string{"Unable to "} + what + " file " + path + ": " + std::strerror(errno) + ".";
+}
+
+
+// Read-only mapping of a file viewed as an array of T, usable as a container
+// by container_cursor.
+template<class T>
+class mapped_records {
+   static_assert(std::is_trivially_copyable<T>::value, "Mapped files can only hold trivially copyable elements.");
+
+public:
+   typedef T value_type;
+   typedef const T * const_iterator;
+
+   explicit inline mapped_records(const std::string &path) :
+      address{nullptr},
+      length{0}
+   {
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+         throw std::runtime_error(file_error("open", path));
+      }
+
+      struct stat status;
+      if (::fstat(fd, &status) != 0) {
+         const std::string message = file_error("inspect", path);
+         ::close(fd);
+         throw std::runtime_error(message);
+      }
+      length = static_cast<std::size_t>(status.st_size);
+      if (length % sizeof(T) != 0) {
+         ::close(fd);
+         throw std::length_error("Mapped file size is not a multiple of the element size.");
+      }
+
+      if (length != 0) {
+         address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (address == MAP_FAILED) {
+            const std::string message = file_error("map", path);
+            ::close(fd);
+            throw std::runtime_error(message);
+         }
+         ::madvise(address, length, MADV_SEQUENTIAL);
+      }
+      ::close(fd);
+   }
+
+   mapped_records(const mapped_records &) = delete;
+   mapped_records & operator =(const mapped_records &) = delete;
+
+   inline ~mapped_records() {
+      if (length != 0) {
+         ::munmap(address, length);
+      }
+   }
+
+   inline const_iterator begin() const noexcept {
+      return static_cast<const T *>(address);
+   }
+
+   inline const_iterator end() const noexcept {
+      return begin() + size();
+   }
+
+   inline std::size_t size() const noexcept {
+      return length / sizeof(T);
+   }
+
+private:
+   void *address;
+   std::size_t length;
+};
+
+
+// Closes the descriptor it owns.
+class file_descriptor {
+public:
+   inline file_descriptor(int fd, bool owned) noexcept :
+      fd{fd},
+      owned{owned}
+   {
+   }
+
+   inline file_descriptor(file_descriptor &&other) noexcept :
+      fd{other.fd},
+      owned{other.owned}
+   {
+      other.owned = false;
+   }
+
+   file_descriptor(const file_descriptor &) = delete;
+   file_descriptor & operator =(const file_descriptor &) = delete;
+
+   inline ~file_descriptor() {
+      if (owned) {
+         ::close(fd);
+      }
+   }
+
+   inline int get() const noexcept {
+      return fd;
+   }
+
+private:
+   int fd;
+   bool owned;
+};
+
+
+// Reads blocks into a buffer and yields the lines in it, as views into the
+// buffer or as owning strings, found with memchr (vectorized by the C
+// library).  A line running past the end of the buffer is moved to its front
+// before the next read, and the buffer grows whenever that would leave less
+// than half a block to read into.
+template<bool Owning>
+class lines_cursor {
+public:
+   typedef std::conditional_t<Owning, std::string, boost::string_view> value_type;
+
+   inline lines_cursor(file_descriptor &&f, std::size_t block_size) :
+      file{std::move(f)},
+      buffer(std::max<std::size_t>(block_size, 1)),
+      block{buffer.size()},
+      first{0},
+      last{0},
+      eof{false},
+      exhausted{false}
+   {
+      fetch();
+   }
+
+   inline bool done() const {
+      return exhausted;
+   }
+
+   inline const value_type & current() const {
+      return line;
+   }
+
+   inline void advance() {
+      fetch();
+   }
+
+private:
+   inline void fetch() {
+      std::size_t scanned = first;
+      for (;;) {
+         const char *begin = buffer.data() + first;
+         const void *newline = std::memchr(buffer.data() + scanned, '\n', last - scanned);
+         if (newline) {
+            const char *end = static_cast<const char *>(newline);
+            first = static_cast<std::size_t>(end - buffer.data()) + 1;
+            if (end != begin && end[-1] == '\r') {
+               --end;
+            }
+            line = value_type{begin, static_cast<std::size_t>(end - begin)};
+            return;
+         }
+         if (eof) {
+            exhausted = first == last;
+            line = value_type{begin, last - first};
+            first = last;
+            return;
+         }
+
+         scanned = last - first;
+         read();
+      }
+   }
+
+   // Moves the partial line to the front of the buffer and appends a block.
+   inline void read() {
+      std::memmove(buffer.data(), buffer.data() + first, last - first);
+      last -= first;
+      first = 0;
+      if (buffer.size() - last < (block + 1) / 2) {
+         buffer.resize(std::max(buffer.size() * 2, last + block));
+      }
+
+      for (;;) {
+         const ssize_t n = ::read(file.get(), buffer.data() + last, buffer.size() - last);
+         if (n >= 0) {
+            last += static_cast<std::size_t>(n);
+            eof = n == 0;
+            return;
+         }
+         if (errno != EINTR) {
+            throw std::runtime_error(std::string{"Unable to read lines: "} + std::strerror(errno) + ".");
+         }
+      }
+   }
+
+   file_descriptor file;
+   std::vector<char> buffer;
+   std::size_t block;
+   std::size_t first;
+   std::size_t last;
+   bool eof;
+   bool exhausted;
+   value_type line;
+};
+
+
+// Keyed on ownership rather than on the line type itself, so that boost does
+// not become an associated namespace of the sequence (and of unqualified
+// move() calls on it).
+template<class Line>
+struct lines_ownership {
+   static_assert(std::is_same<Line, boost::string_view>::value || std::is_same<Line, std::string>::value, "Lines are yielded as boost::string_view or std::string.");
+
+   typedef lines_cursor<std::is_same<Line, std::string>::value> cursor_type;
+};
+
+template<class Line>
+using lines_cursor_of = typename lines_ownership<Line>::cursor_type;
+
+}
+
+
+// The elements of a file of fixed-size records, read in place from a
+// read-only memory mapping that lives as long as the sequence.  The sequence
+// is random-access and sized, and aggregates run over the mapping directly.
+// The file must not be truncated while mapped.
+template<class T, class Alloc=std::allocator<void>>
+inline fused_sequence<details_::container_cursor<details_::mapped_records<T>>> from_mapped_file(const std::string &path, const Alloc &alloc={}) {
+   typedef details_::mapped_records<T> records_type;
+
+   return details_::fuse(alloc, details_::container_cursor<records_type>{std::allocate_shared<const records_type>(alloc, path)});
+}
+
+
+// The lines of a file, without their '\n' (or "\r\n") terminators, read in
+// blocks of block_size bytes.  A final line without a terminator is yielded
+// too.  By default each line is a boost::string_view into the sequence's
+// internal buffer, valid only until the sequence advances: anything that keeps
+// elements past that (prefetch, cache, tee, sort, collecting into a container)
+// needs owning lines, e.g. `lines<std::string>(path)`.
+template<class Line=boost::string_view, class Alloc=std::allocator<void>>
+inline fused_sequence<details_::lines_cursor_of<Line>> lines(const std::string &path, std::size_t block_size=64 * 1024, const Alloc &alloc={}) {
+   const int fd = ::open(path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      throw std::runtime_error(details_::file_error("open", path));
+   }
+   details_::file_descriptor file{fd, true};
+#ifdef POSIX_FADV_SEQUENTIAL
+   ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+   return details_::fuse(alloc, details_::lines_cursor_of<Line>{std::move(file), block_size});
+}
+
+
+// As above, reading from the current position of fd, which stays open.
+template<class Line=boost::string_view, class Alloc=std::allocator<void>>
+inline fused_sequence<details_::lines_cursor_of<Line>> lines(int fd, std::size_t block_size=64 * 1024, const Alloc &alloc={}) {
+   return details_::fuse(alloc, details_::lines_cursor_of<Line>{details_::file_descriptor{fd, false}, block_size});
+}
+
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SEQUENCE_GROUPING_H__
+#define SEQUENCE_GROUPING_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+
+namespace details_ {
+
+struct default_hash {
+   template<class T>
+   inline std::size_t operator()(const T &t) const {
+      return std::hash<T>{}(t);
+   }
+};
+
+
+// Single-pass hash aggregation.  Groups are kept in order of first appearance
+// of their key; the hash table only maps each key to its group's position.
+template<class Key, class Value, class Hash, class KeyEqual, class Alloc>
+class group_table {
+   typedef std::pair<Key, Value> entry_type;
+   typedef std::pair<const Key, std::size_t> slot_type;
+
+public:
+   typedef std::vector<entry_type, typename Alloc::template rebind<entry_type>::other> entries_type;
+
+   inline group_table(const Hash &hash, const KeyEqual &equal, const Alloc &alloc) :
+      slots(0, hash, equal, typename slots_type::allocator_type{alloc}),
+      groups(typename entries_type::allocator_type{alloc})
+   {
+   }
+
+   template<class Init>
+   inline Value & operator()(Key key, Init &&init) {
+      auto slot = slots.find(key);
+      if (slot == slots.end()) {
+         // The group is built before its slot is published, so a throwing
+         // init() (or allocation) leaves no slot naming a missing group.
+         groups.emplace_back(key, init());
+         try {
+            slots.emplace(std::move(key), groups.size() - 1);
+         } catch (...) {
+            groups.pop_back();
+            throw;
+         }
+         return groups.back().second;
+      }
+      return groups[slot->second].second;
+   }
+
+   inline entries_type release() {
+      slots.clear();
+      return std::move(groups);
+   }
+
+private:
+   typedef std::unordered_map<Key, std::size_t, Hash, KeyEqual, typename Alloc::template rebind<slot_type>::other> slots_type;
+
+   slots_type slots;
+   entries_type groups;
+};
+
+}
+
+
+template<class KeySelector, class Alloc=std::allocator<void>, class Hash=details_::default_hash, class KeyEqual=std::equal_to<void>>
+inline auto group_by(KeySelector select_key, const Alloc &alloc={}, Hash hash={}, KeyEqual equal={}) {
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::decay_t<std::result_of_t<KeySelector(const S &)>> key_type;
+         typedef std::vector<S, typename Alloc::template rebind<S>::other> group_type;
+
+         details_::group_table<key_type, group_type, Hash, KeyEqual, Alloc> groups{hash, equal, alloc};
+         for (const S &element : s) {
+            groups(select_key(element), [&] { return group_type{typename group_type::allocator_type{alloc}}; }).push_back(element);
+         }
+
+         return from(groups.release());
+      });
+}
+
+
+template<class KeySelector, class T, class Fold, class Alloc=std::allocator<void>, class Hash=details_::default_hash, class KeyEqual=std::equal_to<void>>
+inline auto aggregate_by(KeySelector select_key, T init, Fold fold, const Alloc &alloc={}, Hash hash={}, KeyEqual equal={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::decay_t<std::result_of_t<KeySelector(const S &)>> key_type;
+
+         details_::group_table<key_type, T, Hash, KeyEqual, Alloc> groups{hash, equal, alloc};
+         for (const S &element : s) {
+            T &accumulated = groups(select_key(element), [&] { return init; });
+            accumulated = fold(move(accumulated), element);
+         }
+
+         return from(groups.release());
+      });
+}
+
+#endif
@@ -12,7 +12,7 @@ inline auto all(Predicate p) {
    using std::end;
    using std::all_of;
 
-   return sequence_manipulator([p](sequence<auto> s) {
+   return sequence_manipulator([p](auto s) {
          return all_of(begin(s), end(s), p);
       });
 }
@@ -24,7 +24,7 @@ inline auto any(Predicate p) {
    using std::end;
    using std::any_of;
 
-   return sequence_manipulator([p](sequence<auto> s) {
+   return sequence_manipulator([p](auto s) {
          return any_of(begin(s), end(s), p);
       });
 }
@@ -36,7 +36,7 @@ inline auto none(Predicate p) {
    using std::end;
    using std::none_of;
 
-   return sequence_manipulator([p](sequence<auto> s) {
+   return sequence_manipulator([p](auto s) {
          return none_of(begin(s), end(s), p);
       });
 }
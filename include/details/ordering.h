@@ -6,36 +6,676 @@
 #endif
 
 
+namespace details_ {
+
+// Maps an arithmetic key onto an unsigned integer whose natural order matches
+// the key's: the sign bit of signed integers is flipped, negative floating
+// point values have all their bits flipped and positive ones their sign bit.
+template<class T, class=void>
+struct radix_key : std::false_type {
+};
+
+
+template<class T>
+struct radix_key<T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>> : std::true_type {
+   typedef std::make_unsigned_t<T> bits_type;
+
+   static inline bits_type encode(T key) noexcept {
+      constexpr bits_type sign = std::is_signed<T>::value ? bits_type(bits_type{1} << (std::numeric_limits<bits_type>::digits - 1)) : bits_type{0};
+      return bits_type(bits_type(key) ^ sign);
+   }
+};
+
+
+template<class T>
+struct radix_key<T, std::enable_if_t<std::is_floating_point<T>::value && std::numeric_limits<T>::is_iec559 && (sizeof(T) == 4 || sizeof(T) == 8)>> : std::true_type {
+   typedef std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t> bits_type;
+
+   static inline bits_type encode(T key) noexcept {
+      constexpr bits_type sign = bits_type{1} << (std::numeric_limits<bits_type>::digits - 1);
+
+      // -0.0 and 0.0 compare equal, so they must share a key to stay stable.
+      if (key == T{0}) {
+         key = T{0};
+      }
+
+      bits_type bits;
+      std::memcpy(&bits, &key, sizeof bits);
+      return (bits & sign) ? bits_type(~bits) : bits_type(bits | sign);
+   }
+};
+
+
+// Comparators for which sorting arithmetic keys by radix_key yields the same
+// (stable) order as a comparison sort.
+template<class T, class Comp>
+struct radix_order {
+   static constexpr bool ascending = std::is_same<Comp, std::less<void>>::value || std::is_same<Comp, std::less<T>>::value;
+   static constexpr bool descending = std::is_same<Comp, std::greater<void>>::value || std::is_same<Comp, std::greater<T>>::value;
+   static constexpr bool value = radix_key<T>::value && (ascending || descending);
+
+   static inline auto encode(const T &key) noexcept {
+      typedef typename radix_key<T>::bits_type bits_type;
+      return descending ? bits_type(~radix_key<T>::encode(key)) : radix_key<T>::encode(key);
+   }
+};
+
+
+// Below this many elements a comparison sort beats the radix passes.
+constexpr std::size_t radix_sort_threshold = 256;
+
+
+// Stable LSD radix sort on the unsigned key returned by encode, one byte per
+// pass.  All digit histograms are built in a single pass up front, and passes
+// in which every element has the same digit are skipped.
+template<class T, class Alloc, class Encode>
+inline void radix_sort(std::vector<T, Alloc> &v, Encode encode) {
+   using std::move;
+
+   typedef decltype(encode(v.front())) bits_type;
+   constexpr std::size_t passes = sizeof(bits_type);
+   constexpr std::size_t buckets = 256;
+
+   const std::size_t n = v.size();
+   std::vector<std::size_t> counts(passes * buckets);
+   for (const T &element : v) {
+      const bits_type key = encode(element);
+      for (std::size_t pass = 0; pass < passes; ++pass) {
+         ++counts[pass * buckets + ((key >> (8 * pass)) & 0xff)];
+      }
+   }
+
+   std::vector<T, Alloc> buffer(n, v.get_allocator());
+   std::vector<T, Alloc> *src = &v;
+   std::vector<T, Alloc> *dst = &buffer;
+   for (std::size_t pass = 0; pass < passes; ++pass) {
+      std::size_t *offsets = counts.data() + pass * buckets;
+      if (std::find(offsets, offsets + buckets, n) != offsets + buckets) {
+         continue;
+      }
+
+      std::size_t offset = 0;
+      for (std::size_t digit = 0; digit < buckets; ++digit) {
+         offset += offsets[digit];
+         offsets[digit] = offset - offsets[digit];
+      }
+
+      for (T &element : *src) {
+         (*dst)[offsets[(encode(element) >> (8 * pass)) & 0xff]++] = move(element);
+      }
+      std::swap(src, dst);
+   }
+
+   if (src != &v) {
+      v.swap(buffer);
+   }
+}
+
+
+template<class T, class Alloc, class Comp>
+inline std::enable_if_t<radix_order<T, Comp>::value> sort_buffer(std::vector<T, Alloc> &v, Comp &comp, const parallel_policy &) {
+   if (v.size() < radix_sort_threshold) {
+      std::stable_sort(v.begin(), v.end(), comp);
+      return;
+   }
+   radix_sort(v, [](const T &element) { return radix_order<T, Comp>::encode(element); });
+}
+
+
+template<class T, class Alloc, class Comp>
+inline std::enable_if_t<!radix_order<T, Comp>::value> sort_buffer(std::vector<T, Alloc> &v, Comp &comp, const parallel_policy &policy) {
+   parallel_stable_sort(v, comp, policy);
+}
+
+
+// Stable order of keys, as the permutation of their indices.
+template<class K, class Alloc, class Comp>
+inline std::enable_if_t<radix_order<K, Comp>::value, std::vector<std::size_t>> sort_keys(std::vector<K, Alloc> &keys, Comp &, const parallel_policy &) {
+   typedef typename radix_key<K>::bits_type bits_type;
+   typedef std::pair<bits_type, std::size_t> keyed_type;
+
+   std::vector<keyed_type> keyed;
+   keyed.reserve(keys.size());
+   for (std::size_t i = 0; i < keys.size(); ++i) {
+      keyed.emplace_back(radix_order<K, Comp>::encode(keys[i]), i);
+   }
+
+   if (keyed.size() < radix_sort_threshold) {
+      std::stable_sort(keyed.begin(), keyed.end(), [](const keyed_type &l, const keyed_type &r) { return l.first < r.first; });
+   }
+   else {
+      radix_sort(keyed, [](const keyed_type &k) { return k.first; });
+   }
+
+   std::vector<std::size_t> order;
+   order.reserve(keyed.size());
+   for (const keyed_type &k : keyed) {
+      order.push_back(k.second);
+   }
+   return order;
+}
+
+
+template<class K, class Alloc, class Comp>
+inline std::enable_if_t<!radix_order<K, Comp>::value, std::vector<std::size_t>> sort_keys(std::vector<K, Alloc> &keys, Comp &comp, const parallel_policy &policy) {
+   std::vector<std::size_t> order(keys.size());
+   std::iota(order.begin(), order.end(), std::size_t{0});
+
+   auto by_key = [&](std::size_t l, std::size_t r) { return comp(keys[l], keys[r]); };
+   parallel_stable_sort(order, by_key, policy);
+   return order;
+}
+
+}
+
+
+
+namespace details_ {
+
+// Buffers and sorts its upstream on first access.  Once limited to n elements
+// (take(n) over a sort) it keeps a bounded heap of the n first elements in
+// sorted order instead, needing O(n) memory and O(log n) work per element.
+template<class Upstream, class Comp, class Alloc>
+class sort_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline sort_cursor(Upstream &&u, const parallel_policy &policy, std::size_t reserve, Comp comp, const Alloc &alloc) :
+      upstream(std::move(u)),
+      policy(policy),
+      reserve{reserve},
+      k{unlimited},
+      comp(std::move(comp)),
+      sorted(buffer_type{typename buffer_type::allocator_type{alloc}}),
+      primed{false},
+      position{0}
+   {
+   }
+
+   inline bool done() const {
+      prime();
+      return position == sorted.size();
+   }
+
+   inline const value_type & current() const {
+      prime();
+      return sorted[position];
+   }
+
+   inline void advance() {
+      ++position;
+   }
+
+   inline boost::optional<std::size_t> size_hint() const {
+      if (primed) {
+         return sorted.size() - position;
+      }
+      auto n = size_hint_of(upstream);
+      if (k == unlimited) {
+         return n;
+      }
+      return std::min(k, n.value_or(k));
+   }
+
+   inline void limit(std::size_t n) {
+      if (!primed) {
+         k = std::min(k, n);
+      }
+      else if (n < sorted.size() - position) {
+         sorted.erase(sorted.begin() + position + n, sorted.end());
+      }
+   }
+
+private:
+   typedef std::vector<value_type, typename Alloc::template rebind<value_type>::other> buffer_type;
+   typedef std::pair<value_type, std::size_t> ranked_type;
+
+   static constexpr std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+
+   // Sorting is deferred so that a following take(n) can still limit it.
+   inline void prime() const {
+      if (!primed) {
+         primed = true;
+         if (k == unlimited) {
+            sort_all();
+         }
+         else {
+            select_first();
+         }
+      }
+   }
+
+   inline void sort_all() const {
+      sorted.reserve(std::max(reserve, size_hint_of(upstream).value_or(0)));
+      for (; !upstream.done(); upstream.advance()) {
+         sorted.push_back(upstream.current());
+      }
+      sort_buffer(sorted, comp, policy);
+   }
+
+   inline void select_first() const {
+      if (k == 0) {
+         return;
+      }
+
+      // Ties are broken by input position to keep the selection stable; the
+      // heap's front is the last of the elements kept so far.
+      auto before = [this](const ranked_type &l, const ranked_type &r) {
+            return comp(l.first, r.first) || (!comp(r.first, l.first) && l.second < r.second);
+         };
+
+      std::vector<ranked_type, typename Alloc::template rebind<ranked_type>::other> heap{sorted.get_allocator()};
+      for (std::size_t i = 0; !upstream.done(); upstream.advance(), ++i) {
+         const value_type &element = upstream.current();
+         if (heap.size() < k) {
+            heap.emplace_back(element, i);
+            std::push_heap(heap.begin(), heap.end(), before);
+         }
+         else if (comp(element, heap.front().first)) {
+            std::pop_heap(heap.begin(), heap.end(), before);
+            heap.back() = ranked_type{element, i};
+            std::push_heap(heap.begin(), heap.end(), before);
+         }
+      }
+
+      std::sort_heap(heap.begin(), heap.end(), before);
+      sorted.reserve(heap.size());
+      for (ranked_type &r : heap) {
+         sorted.push_back(std::move(r.first));
+      }
+   }
+
+   mutable Upstream upstream;
+   parallel_policy policy;
+   std::size_t reserve;
+   std::size_t k;
+   mutable Comp comp;
+   mutable buffer_type sorted;
+   mutable bool primed;
+   std::size_t position;
+};
+
+
+template<class Upstream, class Comp, class Alloc>
+constexpr std::size_t sort_cursor<Upstream, Comp, Alloc>::unlimited;
+
+
+// take(n) directly over a sort: only the first n elements are selected.
+template<class Upstream, class Comp, class Alloc>
+inline sort_cursor<Upstream, Comp, Alloc> take_of(sort_cursor<Upstream, Comp, Alloc> &&c, std::size_t n) {
+   c.limit(n);
+   return std::move(c);
+}
+
+
+template<class Comp>
+struct reverse_order {
+   Comp comp;
+
+   template<class L, class R>
+   inline bool operator()(const L &l, const R &r) {
+      return comp(r, l);
+   }
+};
+
+}
+
+
+// Stable sort.  Arithmetic elements compared with std::less or std::greater
+// are radix sorted; otherwise, once the buffered input reaches
+// policy.threshold elements it is sorted with a parallel merge sort on
+// policy.concurrency() threads.  The input is only consumed once the result is
+// first read, and sort() | take(k) selects the first k elements with a bounded
+// heap rather than sorting everything.  Without a policy the sort runs
+// sequentially, as the aggregates do; pass par() to opt in.
+template<class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto sort(const parallel_policy &policy, std::size_t reserve=0, Comp comp={}, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::sort_cursor<decltype(upstream), Comp, Alloc> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), policy, reserve, comp, alloc});
+      });
+}
+
+
 template<class Comp=std::less<void>, class Alloc=std::allocator<void>>
 inline auto sort(std::size_t reserve=0, Comp comp={}, const Alloc &alloc={}) {
-   using std::begin;
-   using std::end;
-   using std::back_inserter;
-   using std::copy;
-   using std::for_each;
+   return sort(sequential(), reserve, comp, alloc);
+}
+
+
+// Memory budget, in bytes, for sorts that spill sorted runs to temporary files
+// once their input outgrows it.  Runs hold budget / sizeof(value_type)
+// elements, so for elements owning heap memory the budget is approximate.  At
+// most fan_in runs (each an open temporary file) are merged at once.
+struct external_memory {
+   std::size_t budget;
+   std::size_t fan_in;
+};
+
+
+inline external_memory memory_budget(std::size_t bytes, std::size_t fan_in=16) {
+   return external_memory{bytes, std::max<std::size_t>(fan_in, 2)};
+}
+
+
+// Writes and reads back elements of trivially copyable types verbatim.  A
+// serializer for other types provides the same two members; read overwrites an
+// existing element, returns false once the stream is exhausted and throws on
+// I/O errors.
+struct binary_serializer {
+   template<class T>
+   inline void write(std::FILE *file, const T &t) const {
+      static_assert(std::is_trivially_copyable<T>::value, "Elements need a serializer to be spilled to disk.");
+
+      if (std::fwrite(std::addressof(t), sizeof(T), 1, file) != 1) {
+         throw std::runtime_error("Unable to write sorted run to temporary file.");
+      }
+   }
+
+   template<class T>
+   inline bool read(std::FILE *file, T &t) const {
+      if (std::fread(std::addressof(t), sizeof(T), 1, file) == 1) {
+         return true;
+      }
+      if (std::ferror(file)) {
+         throw std::runtime_error("Unable to read sorted run from temporary file.");
+      }
+      return false;
+   }
+};
+
+
+namespace details_ {
+
+struct file_closer {
+   inline void operator()(std::FILE *file) const {
+      std::fclose(file);
+   }
+};
+
+
+typedef std::unique_ptr<std::FILE, file_closer> temporary_file;
+
+
+// External merge sort.  The input is cut into runs that fit the memory budget,
+// each run is sorted and written to its own temporary file, and the runs are
+// merged lazily as the output is read.  Input that fits in a single run never
+// touches the disk.  To bound the number of open files, every fan_in runs of
+// the same merge level are merged into one run of the next level as soon as
+// they are written, and the last runs are merged down to fan_in before the
+// output is read.  Runs are only merged with their neighbours, keeping the sort
+// stable.  Merging reads elements back into existing ones, so value_type must
+// be default constructible.
+template<class Upstream, class Comp, class Serializer, class Alloc>
+class external_sort_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline external_sort_cursor(Upstream &&u, const parallel_policy &policy, external_memory memory, Comp comp, Serializer serializer, const Alloc &alloc) :
+      upstream(std::move(u)),
+      policy(policy),
+      run_size{std::max<std::size_t>(memory.budget / sizeof(value_type), 1)},
+      fan_in{std::max<std::size_t>(memory.fan_in, 2)},
+      comp(std::move(comp)),
+      serializer(std::move(serializer)),
+      buffer(buffer_type{typename buffer_type::allocator_type{alloc}}),
+      primed{false},
+      position{0}
+   {
+   }
+
+   inline bool done() const {
+      prime();
+      return runs.empty() ? position == buffer.size() : heap.empty();
+   }
+
+   inline const value_type & current() const {
+      prime();
+      return runs.empty() ? buffer[position] : runs[heap.front()].head;
+   }
+
+   inline void advance() {
+      if (runs.empty()) {
+         ++position;
+         return;
+      }
+      next_of(heap);
+   }
+
+private:
+   typedef std::vector<value_type, typename Alloc::template rebind<value_type>::other> buffer_type;
+
+   struct run_reader {
+      temporary_file file;
+      value_type head;
+      std::size_t level;
+   };
+
+   // Heap order putting the smallest head on top; ties go to the earlier run,
+   // which holds the earlier input, keeping the merge stable.
+   inline auto ordering() const {
+      return [this](std::size_t l, std::size_t r) {
+            return comp(runs[r].head, runs[l].head) || (!comp(runs[l].head, runs[r].head) && r < l);
+         };
+   }
+
+   inline void prime() const {
+      if (primed) {
+         return;
+      }
+      primed = true;
+
+      buffer.reserve(std::min(run_size, size_hint_of(upstream).value_or(0)));
+      for (; !upstream.done(); upstream.advance()) {
+         if (buffer.size() == run_size) {
+            spill();
+         }
+         buffer.push_back(upstream.current());
+      }
+
+      if (runs.empty()) {
+         sort_buffer(buffer, comp, policy);
+         return;
+      }
+
+      spill();
+      buffer_type{buffer.get_allocator()}.swap(buffer);
+
+      while (runs.size() > fan_in) {
+         const std::size_t merged = std::min(fan_in, runs.size() - fan_in + 1);
+         merge_runs(runs.size() - merged);
+      }
+      open_runs(0, heap);
+   }
+
+   inline void spill() const {
+      sort_buffer(buffer, comp, policy);
+
+      temporary_file file = create_run();
+      for (const value_type &element : buffer) {
+         serializer.write(file.get(), element);
+      }
+      runs.push_back(run_reader{finish_run(std::move(file)), value_type{}, 0});
+      buffer.clear();
+
+      for (;;) {
+         const std::size_t level = runs.back().level;
+         std::size_t same = 0;
+         while (same < runs.size() && runs[runs.size() - 1 - same].level == level) {
+            ++same;
+         }
+         if (same < fan_in) {
+            break;
+         }
+         merge_runs(runs.size() - fan_in);
+      }
+   }
+
+   // Replaces runs [first, runs.size()) with a single run merging them, one
+   // level above the highest of them.
+   inline void merge_runs(std::size_t first) const {
+      std::size_t level = 0;
+      for (std::size_t i = first; i < runs.size(); ++i) {
+         level = std::max(level, runs[i].level + 1);
+      }
+
+      temporary_file file = create_run();
+      std::vector<std::size_t> merging;
+      for (open_runs(first, merging); !merging.empty(); next_of(merging)) {
+         serializer.write(file.get(), runs[merging.front()].head);
+      }
+      runs.erase(runs.begin() + first, runs.end());
+      runs.push_back(run_reader{finish_run(std::move(file)), value_type{}, level});
+   }
+
+   // Rewinds runs [first, runs.size()) and heaps those holding an element.
+   inline void open_runs(std::size_t first, std::vector<std::size_t> &h) const {
+      h.clear();
+      for (std::size_t i = first; i < runs.size(); ++i) {
+         std::rewind(runs[i].file.get());
+         if (serializer.read(runs[i].file.get(), runs[i].head)) {
+            h.push_back(i);
+         }
+      }
+      std::make_heap(h.begin(), h.end(), ordering());
+   }
+
+   // Moves past the smallest head in h, closing its run once exhausted.
+   inline void next_of(std::vector<std::size_t> &h) const {
+      auto later = ordering();
+      std::pop_heap(h.begin(), h.end(), later);
+      run_reader &run = runs[h.back()];
+      if (serializer.read(run.file.get(), run.head)) {
+         std::push_heap(h.begin(), h.end(), later);
+      }
+      else {
+         h.pop_back();
+         run.file.reset();
+      }
+   }
+
+   static inline temporary_file create_run() {
+      temporary_file file{std::tmpfile()};
+      if (!file) {
+         throw std::runtime_error("Unable to create temporary file for sorted run.");
+      }
+      return file;
+   }
+
+   static inline temporary_file finish_run(temporary_file file) {
+      if (std::fflush(file.get()) != 0) {
+         throw std::runtime_error("Unable to write sorted run to temporary file.");
+      }
+      return file;
+   }
+
+   mutable Upstream upstream;
+   parallel_policy policy;
+   std::size_t run_size;
+   std::size_t fan_in;
+   mutable Comp comp;
+   mutable Serializer serializer;
+   mutable buffer_type buffer;
+   mutable std::vector<run_reader> runs;
+   mutable std::vector<std::size_t> heap;
+   mutable bool primed;
+   std::size_t position;
+};
+
+}
+
+
+// Stable sort of input that may not fit in memory: sorted runs of at most
+// memory.budget bytes (each sorted as by sort(policy)) are spilled to
+// temporary files and merged as the result is read.  Elements are written
+// with serializer (see binary_serializer) and must be default constructible.
+// Runs are sorted sequentially unless a policy is given.
+template<class Comp=std::less<void>, class Serializer=binary_serializer, class Alloc=std::allocator<void>>
+inline auto sort(const parallel_policy &policy, external_memory memory, Comp comp={}, Serializer serializer={}, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::external_sort_cursor<decltype(upstream), Comp, Serializer, Alloc> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), policy, memory, comp, serializer, alloc});
+      });
+}
+
+
+template<class Comp=std::less<void>, class Serializer=binary_serializer, class Alloc=std::allocator<void>>
+inline auto sort(external_memory memory, Comp comp={}, Serializer serializer={}, const Alloc &alloc={}) {
+   return sort(sequential(), memory, comp, serializer, alloc);
+}
+
+
+// The k first elements in comp order, from a single pass in O(n log k).
+template<class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto bottom_k(std::size_t k, Comp comp={}, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::sort_cursor<decltype(upstream), Comp, Alloc> cursor_type;
+
+         cursor_type c{move(upstream), sequential(), 0, comp, alloc};
+         c.limit(k);
+         return details_::fuse(alloc, move(c));
+      });
+}
+
+
+// The k last elements in comp order (the k largest by default), last first.
+template<class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto top_k(std::size_t k, Comp comp={}, const Alloc &alloc={}) {
+   return bottom_k(k, details_::reverse_order<Comp>{comp}, alloc);
+}
+
+
+// Stable sort by the key select_key extracts from each element.  Keys are
+// computed once per element; arithmetic keys compared with std::less or
+// std::greater are radix sorted.  Sequential unless a policy is given.
+template<class KeySelector, class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto sort_by(const parallel_policy &policy, KeySelector select_key, Comp comp={}, std::size_t reserve=0, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::move;
-   using std::ref;
-   using std::stable_sort;
 
    return sequence_manipulator([=](sequence<auto> s) mutable {
          typedef typename decltype(s)::value_type S;
-         typedef sequence<S> sequence_type;
+         typedef std::decay_t<std::result_of_t<KeySelector(const S &)>> key_type;
          typedef typename Alloc::template rebind<S>::other v_alloc;
+         typedef typename Alloc::template rebind<key_type>::other k_alloc;
 
          std::vector<S, v_alloc> v{v_alloc{alloc}};
-         v.reserve(reserve);
-         copy(begin(s), end(s), back_inserter(v));
-         stable_sort(begin(v), end(v), comp);
+         std::vector<key_type, k_alloc> keys{k_alloc{alloc}};
+         v.reserve(std::max(reserve, s.size_hint().value_or(0)));
+         keys.reserve(v.capacity());
+         for (const S &element : s) {
+            v.push_back(element);
+            keys.push_back(select_key(v.back()));
+         }
+         std::vector<std::size_t> order = details_::sort_keys(keys, comp, policy);
 
-         return sequence_type{std::allocator_arg, alloc, [v=move(v)](auto &yield) mutable {
-            for_each(begin(v), end(v), ref(yield));
-         }};
+         return sequence<S>{std::allocator_arg, alloc, attrs, [v=move(v), order=move(order)](auto &yield) mutable {
+               for (std::size_t i : order) {
+                  yield(v[i]);
+               }
+            }};
       });
 }
 
 
+template<class KeySelector, class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto sort_by(KeySelector select_key, Comp comp={}, std::size_t reserve=0, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
+   return sort_by(sequential(), select_key, comp, reserve, alloc, attrs);
+}
+
+
 template<class Alloc=std::allocator<void>>
-inline auto reverse(std::size_t reserve=0, const Alloc &alloc={}) {
+inline auto reverse(std::size_t reserve=0, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::begin;
    using std::end;
    using std::back_inserter;
@@ -47,11 +687,11 @@ inline auto reverse(std::size_t reserve=0, const Alloc &alloc={}) {
    return sequence_manipulator([=](sequence<auto> s) mutable {
          typedef typename decltype(s)::value_type S;
 
-         return sequence<S>{std::allocator_arg, alloc, [=, s=move(s)](auto &yield) mutable {
+         return sequence<S>{std::allocator_arg, alloc, attrs, [=, s=move(s)](auto &yield) mutable {
                typedef typename Alloc::template rebind<S>::other v_alloc;
 
                std::vector<S, v_alloc> v{v_alloc{alloc}};
-               v.reserve(reserve);
+               v.reserve(std::max(reserve, s.size_hint().value_or(0)));
                copy(begin(s), end(s), back_inserter(v));
                for_each(v.rbegin(), v.rend(), ref(yield));
             }};
@@ -0,0 +1,678 @@
+#ifndef SEQUENCE_PARALLEL_H__
+#define SEQUENCE_PARALLEL_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+
+// Runs the tasks that parallel operators split their work into.  The library
+// submits to default_executor() unless a policy names another one; embedding
+// applications can replace it with set_default_executor() (e.g. with a pool
+// sized to the cores they set aside, or an adapter over their own scheduler).
+class executor {
+public:
+   virtual ~executor() = default;
+
+   // Schedules task, which must not throw, to run on some thread.
+   virtual void execute(std::function<void()> task) = 0;
+
+   // Runs one scheduled task on the calling thread, if any is waiting; used by
+   // threads that wait on tasks they submitted, so that nested parallel
+   // operators cannot starve the executor.
+   virtual bool run_pending() {
+      return false;
+   }
+
+   // Number of threads, including one waiting caller, working on tasks.
+   virtual std::size_t concurrency() const = 0;
+};
+
+
+// Fixed set of workers, each with its own deque of tasks.  Tasks submitted by
+// a worker go to the back of its own deque, others to the workers' deques in
+// turn.  Workers take tasks from the back of their own deque and, when it is
+// empty, steal from the front of the others'.
+class work_stealing_pool : public executor {
+public:
+   explicit inline work_stealing_pool(std::size_t workers) :
+      queues(std::max<std::size_t>(workers, 1)),
+      queued{0},
+      next{0},
+      stopping{false}
+   {
+      threads.reserve(workers);
+      for (std::size_t i = 0; i < workers; ++i) {
+         threads.emplace_back([this, i] { work(i); });
+      }
+   }
+
+   work_stealing_pool(const work_stealing_pool &) = delete;
+   work_stealing_pool & operator =(const work_stealing_pool &) = delete;
+
+   // Runs the tasks still queued, then stops the workers.
+   inline ~work_stealing_pool() {
+      {
+         std::lock_guard<std::mutex> lock{sleep};
+         stopping = true;
+      }
+      wake.notify_all();
+      for (auto &thread : threads) {
+         thread.join();
+      }
+      while (run_pending()) {
+      }
+   }
+
+   inline void execute(std::function<void()> task) override {
+      const std::size_t own = worker_index();
+      queue_type &q = queues[own != npos ? own : next.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+      {
+         std::lock_guard<std::mutex> lock{q.mutex};
+         q.tasks.push_back(std::move(task));
+      }
+      queued.fetch_add(1, std::memory_order_release);
+      {
+         std::lock_guard<std::mutex> lock{sleep};
+      }
+      wake.notify_one();
+   }
+
+   inline bool run_pending() override {
+      std::function<void()> task;
+      if (!take(worker_index(), task)) {
+         return false;
+      }
+      task();
+      return true;
+   }
+
+   inline std::size_t concurrency() const override {
+      return threads.size() + 1;
+   }
+
+private:
+   static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+   struct queue_type {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+   };
+
+   struct worker_identity {
+      const work_stealing_pool *pool;
+      std::size_t index;
+   };
+
+   static inline worker_identity & identity() {
+      static thread_local worker_identity id{nullptr, npos};
+      return id;
+   }
+
+   inline std::size_t worker_index() const {
+      const worker_identity &id = identity();
+      return id.pool == this ? id.index : npos;
+   }
+
+   // Takes a task from the back of queue own (unless npos), or else from the
+   // front of another queue.
+   inline bool take(std::size_t own, std::function<void()> &task) {
+      if (queued.load(std::memory_order_acquire) == 0) {
+         return false;
+      }
+      if (own != npos && pop(queues[own], task, false)) {
+         return true;
+      }
+      const std::size_t start = own != npos ? own + 1 : 0;
+      for (std::size_t i = 0; i < queues.size(); ++i) {
+         const std::size_t victim = (start + i) % queues.size();
+         if (victim != own && pop(queues[victim], task, true)) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   inline bool pop(queue_type &q, std::function<void()> &task, bool front) {
+      std::lock_guard<std::mutex> lock{q.mutex};
+      if (q.tasks.empty()) {
+         return false;
+      }
+      if (front) {
+         task = std::move(q.tasks.front());
+         q.tasks.pop_front();
+      }
+      else {
+         task = std::move(q.tasks.back());
+         q.tasks.pop_back();
+      }
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+   }
+
+   inline void work(std::size_t index) {
+      identity() = worker_identity{this, index};
+
+      std::function<void()> task;
+      for (;;) {
+         if (take(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+         }
+
+         std::unique_lock<std::mutex> lock{sleep};
+         wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) != 0; });
+         if (stopping && queued.load(std::memory_order_acquire) == 0) {
+            return;
+         }
+      }
+   }
+
+   std::vector<queue_type> queues;
+   std::atomic<std::size_t> queued;
+   std::atomic<std::size_t> next;
+   std::mutex sleep;
+   std::condition_variable wake;
+   bool stopping;
+   std::vector<std::thread> threads;
+};
+
+
+namespace details_ {
+
+inline std::mutex & default_executor_mutex() {
+   static std::mutex mutex;
+   return mutex;
+}
+
+
+inline std::shared_ptr<executor> & default_executor_slot() {
+   static std::shared_ptr<executor> instance;
+   return instance;
+}
+
+}
+
+
+// The executor parallel operators use when their policy names none; unless
+// replaced, a work_stealing_pool with one worker less than the hardware
+// threads, created on first use.
+inline std::shared_ptr<executor> default_executor() {
+   std::lock_guard<std::mutex> lock{details_::default_executor_mutex()};
+
+   auto &instance = details_::default_executor_slot();
+   if (!instance) {
+      const std::size_t hardware = std::thread::hardware_concurrency();
+      instance = std::make_shared<work_stealing_pool>(hardware > 1 ? hardware - 1 : 0);
+   }
+   return instance;
+}
+
+
+// Replaces the default executor.  Operators already running keep the one they
+// started with.
+inline void set_default_executor(std::shared_ptr<executor> e) {
+   std::lock_guard<std::mutex> lock{details_::default_executor_mutex()};
+
+   details_::default_executor_slot() = std::move(e);
+}
+
+
+// Controls how operators that can split their work across threads do so.
+// `threads` of 0 means the executor's concurrency; inputs smaller than
+// `threshold` elements are always processed on the calling thread.  Tasks run
+// on `pool`, or on default_executor() if it is null.
+struct parallel_policy {
+   std::size_t threads;
+   std::size_t threshold;
+   executor *pool = nullptr;
+
+   inline std::size_t concurrency() const {
+      if (threads != 0) {
+         return threads;
+      }
+      return pool ? pool->concurrency() : default_executor()->concurrency();
+   }
+
+   // Number of tasks to split n elements into.
+   inline std::size_t tasks_for(std::size_t n) const {
+      if (n < threshold || n < 2) {
+         return 1;
+      }
+      return std::min(concurrency(), n);
+   }
+
+   // This policy, running its tasks on e, which must outlive their use.
+   inline parallel_policy on(executor &e) const {
+      parallel_policy policy = *this;
+      policy.pool = &e;
+      return policy;
+   }
+};
+
+
+inline parallel_policy par(std::size_t threads=0, std::size_t threshold=std::size_t{1} << 16) {
+   return parallel_policy{threads, threshold};
+}
+
+
+inline parallel_policy sequential() {
+   return parallel_policy{1, 0};
+}
+
+
+namespace details_ {
+
+// Thrown on a prefetch worker, from the interruption points below, once its
+// consumer has gone; the worker catches it and stops.
+struct cancelled {
+};
+
+
+// The flag a prefetch worker's consumer raises when it goes away, set on the
+// worker's thread while it runs its upstream.  Operators that may read many
+// upstream elements before producing one call poll() now and then, so that an
+// abandoned worker does not keep going until the next element is produced.
+struct cancellation {
+   static inline const std::atomic<bool> *& flag() noexcept {
+      static thread_local const std::atomic<bool> *f = nullptr;
+      return f;
+   }
+
+   static inline void poll() {
+      const std::atomic<bool> *f = flag();
+      if (f && f->load(std::memory_order_relaxed)) {
+         throw cancelled{};
+      }
+   }
+};
+
+
+// The executor a policy's tasks run on; only owning when it is the default.
+inline std::shared_ptr<executor> executor_of(const parallel_policy &policy) {
+   return policy.pool ? std::shared_ptr<executor>{std::shared_ptr<executor>{}, policy.pool} : default_executor();
+}
+
+
+// Waits until done() holds under mutex, running e's queued tasks meanwhile.
+template<class Done>
+inline void help_until(executor &e, std::mutex &mutex, std::condition_variable &changed, Done done) {
+   for (;;) {
+      {
+         std::lock_guard<std::mutex> lock{mutex};
+         if (done()) {
+            return;
+         }
+      }
+      if (!e.run_pending()) {
+         // Nothing is queued, so the tasks awaited are running elsewhere.
+         std::unique_lock<std::mutex> lock{mutex};
+         changed.wait(lock, done);
+         return;
+      }
+   }
+}
+
+
+// Runs f(0) ... f(tasks - 1) on e, running the last task and then any waiting
+// ones on the calling thread until all are done, and rethrows the first
+// exception raised by any of them.
+template<class F>
+inline void parallel_for(executor &e, std::size_t tasks, F &&f) {
+   if (tasks < 2) {
+      if (tasks == 1) {
+         f(std::size_t{0});
+      }
+      return;
+   }
+
+   std::vector<std::exception_ptr> errors(tasks);
+   std::mutex mutex;
+   std::condition_variable finished;
+   std::size_t left = tasks - 1;
+
+   auto run = [&](std::size_t i) {
+         try {
+            f(i);
+         }
+         catch (...) {
+            errors[i] = std::current_exception();
+         }
+      };
+
+   for (std::size_t i = 0; i + 1 < tasks; ++i) {
+      e.execute([&, i] {
+            run(i);
+            std::lock_guard<std::mutex> lock{mutex};
+            if (--left == 0) {
+               finished.notify_all();
+            }
+         });
+   }
+   run(tasks - 1);
+   help_until(e, mutex, finished, [&] { return left == 0; });
+
+   for (auto &error : errors) {
+      if (error) {
+         std::rethrow_exception(error);
+      }
+   }
+}
+
+
+template<class F>
+inline void parallel_for(const parallel_policy &policy, std::size_t tasks, F &&f) {
+   parallel_for(*executor_of(policy), tasks, std::forward<F>(f));
+}
+
+
+// Bounds of `tasks` nearly equal slices of [0, n).
+inline std::vector<std::size_t> partition_bounds(std::size_t n, std::size_t tasks) {
+   std::vector<std::size_t> bounds(tasks + 1);
+   for (std::size_t i = 0; i <= tasks; ++i) {
+      bounds[i] = n * i / tasks;
+   }
+   return bounds;
+}
+
+
+// Stable merge of [first, middle) and [middle, last) into out, preferring the
+// left run on ties.  Unlike std::merge over move iterators, comp sees lvalues.
+template<class InputIterator, class OutputIterator, class Comp>
+inline void move_merge(InputIterator first, InputIterator middle, InputIterator last, OutputIterator out, Comp &comp) {
+   using std::move;
+
+   InputIterator l = first;
+   InputIterator r = middle;
+   while (l != middle && r != last) {
+      if (comp(*r, *l)) {
+         *out++ = move(*r++);
+      }
+      else {
+         *out++ = move(*l++);
+      }
+   }
+   out = move(l, middle, out);
+   move(r, last, out);
+}
+
+
+// Stable merge sort: slices are stable-sorted concurrently, then adjacent runs
+// are merged pairwise (each round in parallel), ping-ponging between v and a
+// buffer of the same size.
+template<class T, class Alloc, class Comp>
+inline void parallel_stable_sort(std::vector<T, Alloc> &v, Comp &comp, const parallel_policy &policy) {
+   using std::begin;
+   using std::end;
+   using std::make_move_iterator;
+   using std::move;
+
+   const std::size_t tasks = policy.tasks_for(v.size());
+   if (tasks < 2) {
+      std::stable_sort(begin(v), end(v), comp);
+      return;
+   }
+
+   std::vector<T, Alloc> buffer(make_move_iterator(begin(v)), make_move_iterator(end(v)), v.get_allocator());
+   std::vector<std::size_t> bounds = partition_bounds(v.size(), tasks);
+
+   parallel_for(policy, tasks, [&](std::size_t i) {
+         std::stable_sort(begin(buffer) + bounds[i], begin(buffer) + bounds[i + 1], comp);
+      });
+
+   std::vector<T, Alloc> *src = &buffer;
+   std::vector<T, Alloc> *dst = &v;
+   while (bounds.size() > 2) {
+      const std::size_t runs = bounds.size() - 1;
+      auto s = begin(*src);
+      auto d = begin(*dst);
+
+      parallel_for(policy, (runs + 1) / 2, [&](std::size_t pair) {
+            const std::size_t first = bounds[2 * pair];
+            const std::size_t middle = bounds[std::min(2 * pair + 1, runs)];
+            const std::size_t last = bounds[std::min(2 * pair + 2, runs)];
+            move_merge(s + first, s + middle, s + last, d + first, comp);
+         });
+
+      std::vector<std::size_t> merged;
+      for (std::size_t i = 0; i < runs; i += 2) {
+         merged.push_back(bounds[i]);
+      }
+      merged.push_back(bounds.back());
+      bounds.swap(merged);
+      std::swap(src, dst);
+   }
+
+   if (src != &v) {
+      std::move(begin(*src), end(*src), begin(v));
+   }
+}
+
+}
+
+// Whether parallel_select and parallel_where yield results in the order of
+// their inputs.
+enum class result_order {
+   preserved,
+   unordered
+};
+
+
+namespace details_ {
+
+// Reads the upstream in batches on the calling thread and applies work, which
+// maps an element to an engaged optional result or to none, to the elements
+// of each batch split into policy.tasks_for(batch) slices.  Results are kept
+// in upstream order, so a batch is only yielded once all its slices are done.
+// With result_order::unordered, the slices run in the background instead and
+// each one's results are yielded as soon as it finishes, while later slices
+// are still running; results are then only ordered within their slice.
+template<class Upstream, class Work>
+class parallel_map_cursor {
+public:
+   typedef typename decltype(std::declval<Work &>()(std::declval<const typename Upstream::value_type &>()))::value_type value_type;
+
+   inline parallel_map_cursor(Upstream &&u, Work work, const parallel_policy &policy, std::size_t batch, result_order order) :
+      upstream(std::move(u)),
+      policy(policy),
+      batch{batch != 0 ? batch : 1024 * policy.concurrency()},
+      order{order},
+      state{new batch_state{std::move(work)}},
+      position{0}
+   {
+      fill();
+   }
+
+   parallel_map_cursor(parallel_map_cursor &&) = default;
+
+   // Slices still running refer to the batch state.
+   inline ~parallel_map_cursor() {
+      if (state && state->pool) {
+         wait([this] { return state->running == 0; });
+      }
+   }
+
+   inline bool done() const {
+      return position == results.size();
+   }
+
+   inline const value_type & current() const {
+      return results[position];
+   }
+
+   inline void advance() {
+      if (++position == results.size()) {
+         fill();
+      }
+   }
+
+private:
+   typedef typename Upstream::value_type input_type;
+
+   // Whatever the slices of a batch share, apart from the cursor (which may
+   // move while they run).
+   struct batch_state {
+      inline explicit batch_state(Work &&w) :
+         work(std::move(w)),
+         running{0}
+      {
+      }
+
+      Work work;
+      std::vector<input_type> inputs;
+      std::vector<boost::optional<value_type>> staged;
+      std::shared_ptr<executor> pool;
+      std::mutex mutex;
+      std::condition_variable changed;
+      std::deque<std::vector<value_type>> finished;
+      std::size_t running;
+      std::exception_ptr error;
+   };
+
+   inline void fill() {
+      results.clear();
+      position = 0;
+      while (results.empty()) {
+         cancellation::poll();
+         if (order == result_order::unordered && state->pool && next_slice()) {
+            continue;
+         }
+         if (upstream.done()) {
+            return;
+         }
+
+         state->inputs.clear();
+         for (; state->inputs.size() < batch && !upstream.done(); upstream.advance()) {
+            state->inputs.push_back(upstream.current());
+         }
+         if (order == result_order::preserved) {
+            map_in_order();
+         }
+         else {
+            start_slices();
+         }
+      }
+   }
+
+   inline void map_in_order() {
+      auto &s = *state;
+      const std::size_t tasks = policy.tasks_for(s.inputs.size());
+      const std::vector<std::size_t> bounds = partition_bounds(s.inputs.size(), tasks);
+
+      s.staged.clear();
+      s.staged.resize(s.inputs.size());
+      parallel_for(policy, tasks, [&](std::size_t i) {
+            for (std::size_t j = bounds[i]; j < bounds[i + 1]; ++j) {
+               s.staged[j] = s.work(s.inputs[j]);
+            }
+         });
+
+      for (auto &result : s.staged) {
+         if (result) {
+            results.push_back(std::move(*result));
+         }
+      }
+   }
+
+   // Maps the slice [first, last) of the batch into its own vector.
+   static inline std::vector<value_type> map_slice(batch_state &s, std::size_t first, std::size_t last) {
+      std::vector<value_type> slice;
+      for (std::size_t j = first; j < last; ++j) {
+         auto result = s.work(s.inputs[j]);
+         if (result) {
+            slice.push_back(std::move(*result));
+         }
+      }
+      return slice;
+   }
+
+   // Submits every slice of the batch, or maps a batch too small to split
+   // right away.
+   inline void start_slices() {
+      using std::move;
+
+      const std::size_t tasks = policy.tasks_for(state->inputs.size());
+      if (tasks < 2) {
+         results = map_slice(*state, 0, state->inputs.size());
+         return;
+      }
+
+      const std::vector<std::size_t> bounds = partition_bounds(state->inputs.size(), tasks);
+      batch_state *s = state.get();
+      s->pool = executor_of(policy);
+      s->running = tasks;
+      for (std::size_t i = 0; i < tasks; ++i) {
+         auto task = [s, first=bounds[i], last=bounds[i + 1]] {
+               std::vector<value_type> slice;
+               std::exception_ptr error;
+               try {
+                  slice = map_slice(*s, first, last);
+               }
+               catch (...) {
+                  error = std::current_exception();
+               }
+
+               std::lock_guard<std::mutex> lock{s->mutex};
+               if (error) {
+                  if (!s->error) {
+                     s->error = error;
+                  }
+               }
+               else if (!slice.empty()) {
+                  s->finished.push_back(std::move(slice));
+               }
+               --s->running;
+               s->changed.notify_all();
+            };
+
+         try {
+            s->pool->execute(move(task));
+         }
+         catch (...) {
+            std::lock_guard<std::mutex> lock{s->mutex};
+            s->running -= tasks - i;
+            throw;
+         }
+      }
+   }
+
+   // Waits for the next finished slice of the batch in flight and takes its
+   // results; false once every slice was taken.  Rethrows the first exception
+   // raised by a slice once none is running any more.
+   inline bool next_slice() {
+      auto &s = *state;
+      wait([&s] { return s.running == 0 || (!s.error && !s.finished.empty()); });
+
+      std::lock_guard<std::mutex> lock{s.mutex};
+      if (s.error) {
+         s.pool = nullptr;
+         s.finished.clear();
+         std::rethrow_exception(std::exchange(s.error, nullptr));
+      }
+      if (!s.finished.empty()) {
+         results = std::move(s.finished.front());
+         s.finished.pop_front();
+         return true;
+      }
+      s.pool = nullptr;
+      return false;
+   }
+
+   template<class Done>
+   inline void wait(Done done) {
+      help_until(*state->pool, state->mutex, state->changed, done);
+   }
+
+   Upstream upstream;
+   parallel_policy policy;
+   std::size_t batch;
+   result_order order;
+   std::unique_ptr<batch_state> state;
+   std::vector<value_type> results;
+   std::size_t position;
+};
+
+}
+
+#endif
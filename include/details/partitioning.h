@@ -6,21 +6,113 @@
 #endif
 
 
+namespace details_ {
+
+template<class Upstream>
+class take_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline take_cursor(Upstream &&u, std::size_t n) :
+      upstream(std::move(u)),
+      left{n}
+   {
+   }
+
+   inline bool done() const {
+      return left == 0 || upstream.done();
+   }
+
+   inline const value_type & current() const {
+      return upstream.current();
+   }
+
+   inline void advance() {
+      // Never pull the element following the last one taken.
+      if (--left > 0) {
+         upstream.advance();
+      }
+   }
+
+   template<class U=Upstream>
+   inline auto remaining() const -> decltype(std::declval<const U &>().remaining()) {
+      return std::min(left, upstream.remaining());
+   }
+
+   template<class U=Upstream>
+   inline auto advance(std::size_t n) -> decltype(std::declval<U &>().advance(n)) {
+      left -= n;
+      if (left > 0) {
+         upstream.advance(n);
+      }
+   }
+
+   // Only bounded when the upstream is: n alone says nothing of how many
+   // elements there are, and callers reserve storage from hints.
+   inline boost::optional<std::size_t> size_hint() const {
+      auto n = size_hint_of(upstream);
+      if (n) {
+         return std::min(left, *n);
+      }
+      return n;
+   }
+
+private:
+   Upstream upstream;
+   std::size_t left;
+};
+
+
+template<class Upstream>
+inline take_cursor<Upstream> take_of(Upstream &&u, std::size_t n) {
+   return take_cursor<Upstream>{std::move(u), n};
+}
+
+
+template<class Upstream, class Predicate>
+class take_while_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline take_while_cursor(Upstream &&u, Predicate p) :
+      upstream(std::move(u)),
+      p(std::move(p))
+   {
+      check();
+   }
+
+   inline bool done() const {
+      return !taking;
+   }
+
+   inline const value_type & current() const {
+      return upstream.current();
+   }
+
+   inline void advance() {
+      upstream.advance();
+      check();
+   }
+
+private:
+   inline void check() {
+      taking = !upstream.done() && p(upstream.current());
+   }
+
+   Upstream upstream;
+   Predicate p;
+   bool taking;
+};
+
+}
+
+
 template<class Alloc=std::allocator<void>>
 inline auto take(std::size_t n, const Alloc &alloc={}) {
    using std::move;
 
-   return sequence_manipulator([=](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
-
-         return sequence<S>{std::allocator_arg, alloc, [s=move(s), n](auto &yield) mutable {
-               for (const S &element : s) {
-                  if (n-- == 0) {
-                     break;
-                  }
-                  yield(element);
-               }
-            }};
+   return sequence_manipulator([=](auto s) mutable {
+         return details_::fuse(alloc, details_::take_of(details_::cursor_of(move(s)), n));
       });
 }
 
@@ -29,41 +121,22 @@ template<class Predicate>
 inline auto take_while(Predicate predicate) {
    using std::move;
 
-   return sequence_manipulator([p=predicate](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
-
-         return sequence<S>{[s=move(s), p](auto &yield) mutable {
-               for (const S &element : s) {
-                  if (!p(element)) {
-                     break;
-                  }
-                  yield(element);
-               }
-            }};
+   return sequence_manipulator([p=predicate](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::take_while_cursor<decltype(upstream), Predicate> cursor_type;
+
+         return details_::fuse(std::allocator<void>{}, cursor_type{move(upstream), p});
       });
 }
 
 
 inline auto skip(std::size_t n) {
-   using std::begin;
-   using std::end;
-   using std::move;
-
-   return sequence_manipulator([n](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
-
-         return sequence<S>{[s=move(s), n](auto &yield) mutable {
-               auto i = begin(s);
-               auto e = end(s);
-
-               for (; i != e && n > 0; ++i) {
-                  --n;
-               }
-
-               for (; i != e; ++i) {
-                  yield(*i);
-               }
-            }};
+   return sequence_manipulator([n](auto s) mutable {
+         // Sequences resume from their current element, so skipping is just
+         // advancing in place (in constant time for random-access sources);
+         // no new stage is needed.
+         s.advance(n);
+         return s;
       });
 }
 
@@ -72,25 +145,18 @@ template<class Predicate>
 inline auto skip_while(Predicate predicate) {
    using std::begin;
    using std::end;
-   using std::move;
-
-   return sequence_manipulator([p=predicate](sequence<auto> s) mutable {
-         typedef typename decltype(s)::value_type S;
 
-         return sequence<S>{[s=move(s), p](auto &yield) mutable {
-               auto i = begin(s);
-               auto e = end(s);
+   return sequence_manipulator([p=predicate](auto s) mutable {
+         auto i = begin(s);
+         auto e = end(s);
 
-               for (; i != e; ++i) {
-                  if (!p(*i)) {
-                     break;
-                  }
-               }
+         for (; i != e; ++i) {
+            if (!p(*i)) {
+               break;
+            }
+         }
 
-               for (; i != e; ++i) {
-                  yield(*i);
-               }
-            }};
+         return s;
       });
 }
 
@@ -98,26 +164,8 @@ inline auto skip_while(Predicate predicate) {
 inline auto page(std::size_t page_index, std::size_t page_size) {
    using std::move;
 
-   return sequence_manipulator([=](sequence<auto> s) mutable {
-         // Effective result: return s >> skip(page_index * page_size) >> take(page_size);
-         // This should be a little more efficient due to not having to create a
-         // separate stack to execute.
-         typedef typename decltype(s)::value_type S;
-
-         return sequence<S>{[s=move(s), skip_n=page_index * page_size, take_n=page_size](auto &yield) mutable {
-               for (const S &element : s) {
-                  (void)element;
-                  if (skip_n-- == 0) {
-                     break;
-                  }
-               }
-               for (const S &element : s) {
-                  if (take_n-- == 0) {
-                     break;
-                  }
-                  yield(element);
-               }
-            }};
+   return sequence_manipulator([=](auto s) mutable {
+         return move(s) | skip(page_index * page_size) | take(page_size);
       });
 }
 
@@ -0,0 +1,474 @@
+#ifndef SEQUENCE_PREFETCH_H__
+#define SEQUENCE_PREFETCH_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+
+namespace details_ {
+
+constexpr std::size_t cache_line = 64;
+
+
+// Publishes the pending elements of the queue the calling thread produces
+// into, if any.  A stage calls it before blocking on its own upstream, so that
+// what it has already produced does not wait for that upstream to deliver the
+// rest of the batch.
+struct pending_output {
+   void *queue;
+   void (*publish)(void *);
+
+   static inline pending_output & local() noexcept {
+      static thread_local pending_output output{nullptr, nullptr};
+      return output;
+   }
+
+   static inline void flush() {
+      auto &output = local();
+      if (output.queue) {
+         output.publish(output.queue);
+      }
+   }
+};
+
+
+// Bounded lock-free queue between one producer and one consumer thread.  The
+// shared indices sit on cache lines of their own, apart from each side's
+// private counters, and each side only publishes its index once per `batch`
+// elements (or before it has to wait), so the lines bounce between cores once
+// per batch rather than once per element.  A waiting side yields for a few
+// rounds, then sleeps on a condition variable until the other side publishes.
+// While the consumer waits, the producer publishes every element right away,
+// and a stage about to block on an upstream stage first publishes what it has
+// (see pending_output).  A producer that blocks on any other upstream can't
+// tell it is about to, so a sleeping consumer also wakes every `patience` and
+// takes the elements pushed but not yet published (from `pushed`, a line the
+// consumer only reads then).
+template<class T>
+class spsc_queue {
+public:
+   // capacity is rounded up to a power of two.
+   inline spsc_queue(std::size_t capacity, std::size_t batch) :
+      mask{round_up(capacity) - 1},
+      batch{std::max<std::size_t>(std::min(batch, (mask + 1) / 2), 1)},
+      slots{new slot_type[mask + 1]}
+   {
+   }
+
+   spsc_queue(const spsc_queue &) = delete;
+   spsc_queue & operator =(const spsc_queue &) = delete;
+
+   // Only once the producer has stopped.
+   inline ~spsc_queue() {
+      for (std::size_t i = consumer.head; i != producer.tail; ++i) {
+         at(i)->~T();
+      }
+   }
+
+   // Producer side: makes the calling thread's pending_output this queue,
+   // and its cancellation flag the consumer's.
+   inline void bind_producer() noexcept {
+      pending_output::local() = {this, [](void *q) { static_cast<spsc_queue *>(q)->publish(); }};
+      cancellation::flag() = &cancelled;
+   }
+
+   // Producer side.  Returns false once the consumer has cancelled (noticed
+   // at the end of a batch, or instead of waiting for room).
+   template<class U>
+   inline bool push(U &&value) {
+      if (producer.tail - producer.head == mask + 1 && !wait_for_room()) {
+         return false;
+      }
+
+      new (at(producer.tail)) T(std::forward<U>(value));
+      pushed.store(++producer.tail, std::memory_order_release);
+      if (producer.tail - producer.published >= batch ||
+          consumer_waiting.load(std::memory_order_acquire)) {
+         publish();
+         return !cancelled.load(std::memory_order_acquire);
+      }
+      return true;
+   }
+
+   // Producer side: no more elements will be pushed.  error, if set, is
+   // rethrown to the consumer once it has taken every element before it.
+   inline void close(std::exception_ptr e) {
+      error = std::move(e);
+      publish();
+      closed.store(true, std::memory_order_seq_cst);
+      wake();
+   }
+
+   // Consumer side: the oldest element, waiting for one if needed, or nullptr
+   // once the producer has closed the queue and every element was taken.
+   inline T * front() {
+      if (consumer.head == consumer.tail && !wait_for_elements()) {
+         return nullptr;
+      }
+      return at(consumer.head);
+   }
+
+   // Consumer side: drops the element returned by front().
+   inline void pop() {
+      at(consumer.head)->~T();
+      if (++consumer.head - consumer.released >= batch) {
+         release();
+      }
+   }
+
+   // Consumer side: stops a producer waiting for room.
+   inline void cancel() {
+      cancelled.store(true, std::memory_order_seq_cst);
+      wake();
+   }
+
+private:
+   typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot_type;
+
+   // Rounds of yielding before a waiting side goes to sleep.
+   static constexpr int spins = 64;
+
+   // How long a sleeping consumer waits before taking unpublished elements.
+   static inline std::chrono::milliseconds patience() noexcept {
+      return std::chrono::milliseconds{1};
+   }
+
+   static inline std::size_t round_up(std::size_t n) {
+      std::size_t capacity = 2;
+      while (capacity < n) {
+         capacity *= 2;
+      }
+      return capacity;
+   }
+
+   inline T * at(std::size_t i) {
+      return reinterpret_cast<T *>(&slots[i & mask]);
+   }
+
+   // The sleeping flags and the shared indices are both accessed sequentially
+   // consistently, so a side that publishes after the other went to sleep
+   // always sees its flag and wakes it.
+   inline void publish() {
+      producer.published = producer.tail;
+      tail.store(producer.tail, std::memory_order_seq_cst);
+      if (consumer_sleeping.load(std::memory_order_seq_cst)) {
+         wake();
+      }
+   }
+
+   inline void release() {
+      consumer.released = consumer.head;
+      head.store(consumer.head, std::memory_order_seq_cst);
+      if (producer_sleeping.load(std::memory_order_seq_cst)) {
+         wake();
+      }
+   }
+
+   inline void wake() {
+      { std::lock_guard<std::mutex> lock{sleep_mutex}; }
+      woken.notify_all();
+   }
+
+   inline bool wait_for_room() {
+      publish();
+      for (int round = 0; ; ++round) {
+         producer.head = head.load(std::memory_order_acquire);
+         if (producer.tail - producer.head <= mask) {
+            return true;
+         }
+         if (cancelled.load(std::memory_order_acquire)) {
+            return false;
+         }
+
+         if (round < spins) {
+            std::this_thread::yield();
+            continue;
+         }
+
+         std::unique_lock<std::mutex> lock{sleep_mutex};
+         producer_sleeping.store(true, std::memory_order_seq_cst);
+         woken.wait(lock, [this] {
+               return producer.tail - head.load(std::memory_order_seq_cst) <= mask ||
+                  cancelled.load(std::memory_order_seq_cst);
+            });
+         producer_sleeping.store(false, std::memory_order_relaxed);
+      }
+   }
+
+   inline bool wait_for_elements() {
+      consumer_waiting.store(true, std::memory_order_release);
+      release();
+      struct stop_waiting {
+         std::atomic<bool> &flag;
+         ~stop_waiting() { flag.store(false, std::memory_order_release); }
+      } guard{consumer_waiting};
+
+      for (int round = 0; ; ++round) {
+         consumer.tail = tail.load(std::memory_order_acquire);
+         if (consumer.head != consumer.tail) {
+            return true;
+         }
+         if (closed.load(std::memory_order_acquire)) {
+            consumer.tail = tail.load(std::memory_order_acquire);
+            if (consumer.head != consumer.tail) {
+               return true;
+            }
+            if (error) {
+               std::rethrow_exception(std::exchange(error, nullptr));
+            }
+            return false;
+         }
+
+         if (round < spins) {
+            std::this_thread::yield();
+            continue;
+         }
+
+         // About to block: let whoever this thread feeds have what it has,
+         // and stop if that has gone away.
+         pending_output::flush();
+         cancellation::poll();
+
+         {
+            std::unique_lock<std::mutex> lock{sleep_mutex};
+            consumer_sleeping.store(true, std::memory_order_seq_cst);
+            woken.wait_for(lock, patience(), [this] {
+                  return tail.load(std::memory_order_seq_cst) != consumer.head ||
+                     closed.load(std::memory_order_seq_cst);
+               });
+            consumer_sleeping.store(false, std::memory_order_relaxed);
+         }
+
+         consumer.tail = pushed.load(std::memory_order_acquire);
+         if (consumer.head != consumer.tail) {
+            return true;
+         }
+      }
+   }
+
+   const std::size_t mask;
+   const std::size_t batch;
+   std::unique_ptr<slot_type[]> slots;
+   std::exception_ptr error;
+   std::mutex sleep_mutex;
+   std::condition_variable woken;
+
+   // Groups written by different sides are a cache line apart (padding rather
+   // than alignas, which operator new only honours from C++17).
+   char pad0[cache_line];
+   std::atomic<std::size_t> tail{0};
+   std::atomic<bool> producer_sleeping{false};
+   char pad1[cache_line];
+   std::atomic<std::size_t> head{0};
+   std::atomic<bool> consumer_waiting{false};
+   std::atomic<bool> consumer_sleeping{false};
+   char pad2[cache_line];
+   std::atomic<bool> closed{false};
+   std::atomic<bool> cancelled{false};
+   char pad3[cache_line];
+
+   struct {
+      std::size_t tail = 0;
+      std::size_t published = 0;
+      std::size_t head = 0;
+   } producer;
+   std::atomic<std::size_t> pushed{0};
+   char pad4[cache_line];
+
+   struct {
+      std::size_t head = 0;
+      std::size_t released = 0;
+      std::size_t tail = 0;
+   } consumer;
+   char pad5[cache_line];
+};
+
+
+// Builds the upstream with make() on a worker thread, then runs it there for
+// as long as the queue has room.  Building it on the worker matters for
+// operators that compute their first element as soon as they are applied.
+template<class Make>
+class prefetch_state {
+public:
+   typedef typename decltype(std::declval<Make &>()())::value_type value_type;
+
+   inline prefetch_state(Make &&m, boost::optional<std::size_t> hint, std::size_t capacity, std::size_t batch) :
+      make{std::move(m)},
+      hint{hint},
+      queue{capacity, batch},
+      worker{[this] { produce(); }}
+   {
+   }
+
+   inline ~prefetch_state() {
+      queue.cancel();
+      worker.join();
+   }
+
+   inline boost::optional<std::size_t> initial_size_hint() const noexcept {
+      return hint;
+   }
+
+   inline spsc_queue<value_type> & elements() noexcept {
+      return queue;
+   }
+
+private:
+   inline void produce() {
+      queue.bind_producer();
+      try {
+         cancellation::poll();
+         auto upstream = make();
+         for (const auto &value : upstream) {
+            if (!queue.push(value)) {
+               break;
+            }
+            cancellation::poll();
+         }
+         queue.close(nullptr);
+      }
+      catch (const cancelled &) {
+         queue.close(nullptr);
+      }
+      catch (...) {
+         queue.close(std::current_exception());
+      }
+   }
+
+   Make make;
+   boost::optional<std::size_t> hint;
+   spsc_queue<value_type> queue;
+   std::thread worker;
+};
+
+
+template<class Make>
+class prefetch_cursor {
+public:
+   typedef typename prefetch_state<Make>::value_type value_type;
+
+   inline prefetch_cursor(Make &&make, boost::optional<std::size_t> hint, std::size_t capacity, std::size_t batch) :
+      state{new prefetch_state<Make>{std::move(make), hint, capacity, batch}},
+      value{nullptr},
+      fetched{false},
+      taken{0}
+   {
+   }
+
+   inline bool done() const {
+      return fetch() == nullptr;
+   }
+
+   inline const value_type & current() const {
+      return *fetch();
+   }
+
+   inline void advance() {
+      fetch();
+      state->elements().pop();
+      fetched = false;
+      ++taken;
+   }
+
+   inline boost::optional<std::size_t> size_hint() const {
+      auto n = state->initial_size_hint();
+      if (n) {
+         return *n > taken ? *n - taken : 0;
+      }
+      return n;
+   }
+
+private:
+   inline const value_type * fetch() const {
+      if (!fetched) {
+         value = state->elements().front();
+         fetched = true;
+      }
+      return value;
+   }
+
+   std::unique_ptr<prefetch_state<Make>> state;
+   mutable const value_type *value;
+   mutable bool fetched;
+   std::size_t taken;
+};
+
+
+template<class Make>
+inline auto prefetched(Make make, boost::optional<std::size_t> hint, std::size_t capacity, std::size_t batch) {
+   return fuse(std::allocator<void>{}, prefetch_cursor<Make>{std::move(make), hint, capacity, batch != 0 ? batch : capacity / 8});
+}
+
+
+template<class S, class Op>
+inline auto staged(S s, sequence_operation<Op> &&op, std::size_t capacity, std::size_t batch) {
+   using std::move;
+
+   return prefetched([s=move(s), op=move(op)]() mutable { return op(move(s)); }, boost::none, capacity, batch);
+}
+
+
+template<class S>
+inline S run_stages(S s, std::size_t, std::size_t) {
+   return s;
+}
+
+
+template<class S, class Op, class... Ops>
+inline auto run_stages(S s, std::size_t capacity, std::size_t batch, sequence_operation<Op> &op, sequence_operation<Ops> &... ops) {
+   return run_stages(staged(std::move(s), std::move(op), capacity, batch), capacity, batch, ops...);
+}
+
+
+template<class S, class Stages, std::size_t... I>
+inline auto run_pipeline(S s, Stages &stages, std::size_t capacity, std::size_t batch, std::index_sequence<I...>) {
+   return run_stages(std::move(s), capacity, batch, std::get<I>(stages)...);
+}
+
+}
+
+
+// Runs the upstream on a worker thread ahead of the consumer, keeping up to
+// `capacity` elements in a queue between them, which are handed over in
+// batches of `batch` (by default an eighth of the capacity).  An exception
+// thrown by the upstream is rethrown to the consumer after the elements
+// produced before it.  The upstream starts immediately and must not be shared
+// with the calling thread.
+inline auto prefetch(std::size_t capacity=1024, std::size_t batch=0) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) {
+         auto hint = s.size_hint();
+         return details_::prefetched([s=move(s)]() mutable { return move(s); }, hint, capacity, batch);
+      });
+}
+
+
+// Applies op, and runs it together with everything upstream of it back to the
+// previous stage boundary, on a thread of its own connected to the consumer
+// as by prefetch().
+template<class Op>
+inline auto stage(sequence_operation<Op> op, std::size_t capacity=1024, std::size_t batch=0) {
+   using std::move;
+
+   return sequence_manipulator([op=move(op), capacity, batch](auto s) mutable {
+         return details_::staged(move(s), move(op), capacity, batch);
+      });
+}
+
+
+// Pipeline-parallel form of applying ops in turn: each one becomes a stage()
+// on its own thread, e.g. `s | pipeline(where(p), select(f), select(g))` keeps
+// three threads busy besides the consumer.  Worthwhile when every stage does
+// enough work per element to outweigh handing elements between threads.
+template<class... Ops>
+inline auto pipeline(sequence_operation<Ops>... ops) {
+   using std::move;
+
+   return sequence_manipulator([stages=std::make_tuple(move(ops)...)](auto s) mutable {
+         return details_::run_pipeline(move(s), stages, 1024, 0, std::index_sequence_for<Ops...>{});
+      });
+}
+
+#endif
@@ -29,35 +29,160 @@ public:
    typedef decltype(std::declval<Combiner>()(std::declval<T>(), std::declval<U>())) result_type;
 };
 
+
+// Whether a join comparator is plain key equality, which std::hash agrees
+// with.
+template<class Comp, class Key>
+struct is_key_equality : std::integral_constant<bool, std::is_same<Comp, std::equal_to<void>>::value || std::is_same<Comp, std::equal_to<Key>>::value> {
+};
+
+
+// Hash index over the buffered right-hand rows of a join.  Rows sharing a key
+// are chained through `links` in their original order, so the table stores
+// each distinct key once and probing yields matches in right-hand order.
+template<class Key, class Hash, class KeyEqual, class Alloc>
+class join_index {
+   typedef std::pair<const Key, std::size_t> head_type;
+   typedef std::unordered_map<Key, std::size_t, Hash, KeyEqual, typename Alloc::template rebind<head_type>::other> heads_type;
+   typedef std::vector<std::size_t, typename Alloc::template rebind<std::size_t>::other> links_type;
+
+public:
+   static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+   template<class Rows, class Selector>
+   inline join_index(const Rows &rows, Selector &select, const Hash &hash, const KeyEqual &equal, const Alloc &alloc) :
+      heads(rows.size(), hash, equal, typename heads_type::allocator_type{alloc}),
+      links(rows.size(), npos, typename links_type::allocator_type{alloc})
+   {
+      for (std::size_t i = rows.size(); i-- > 0;) {
+         auto inserted = heads.emplace(select(rows[i]), i);
+         if (!inserted.second) {
+            links[i] = inserted.first->second;
+            inserted.first->second = i;
+         }
+      }
+   }
+
+   template<class K>
+   inline std::size_t first(const K &key) const {
+      auto head = heads.find(key);
+      return head == heads.end() ? npos : head->second;
+   }
+
+   inline std::size_t next(std::size_t i) const {
+      return links[i];
+   }
+
+private:
+   heads_type heads;
+   links_type links;
+};
+
+
+template<class Key, class Hash, class KeyEqual, class Alloc>
+constexpr std::size_t join_index<Key, Hash, KeyEqual, Alloc>::npos;
+
+
+template<class Upstream, class Transform>
+class select_cursor {
+public:
+   typedef std::decay_t<std::result_of_t<Transform(const typename Upstream::value_type &)>> value_type;
+
+   inline select_cursor(Upstream &&u, Transform f) :
+      upstream(std::move(u)),
+      f(std::move(f))
+   {
+      fetch();
+   }
+
+   inline bool done() const {
+      return upstream.done();
+   }
+
+   inline const value_type & current() const {
+      return *value;
+   }
+
+   inline void advance() {
+      upstream.advance();
+      fetch();
+   }
+
+   // Projection preserves the size and random access of the upstream;
+   // skipped elements are never transformed.
+   template<class U=Upstream>
+   inline auto remaining() const -> decltype(std::declval<const U &>().remaining()) {
+      return upstream.remaining();
+   }
+
+   template<class U=Upstream>
+   inline auto advance(std::size_t n) -> decltype(std::declval<U &>().advance(n)) {
+      upstream.advance(n);
+      fetch();
+   }
+
+   inline boost::optional<std::size_t> size_hint() const {
+      return size_hint_of(upstream);
+   }
+
+private:
+   inline void fetch() {
+      if (!upstream.done()) {
+         value = f(upstream.current());
+      }
+   }
+
+   Upstream upstream;
+   Transform f;
+   boost::optional<value_type> value;
+};
+
 }
 
 
 template<class Transform, class Alloc=std::allocator<void>>
 inline auto select(Transform f, const Alloc &alloc={}) {
-   using std::begin;
-   using std::end;
    using std::move;
-   using std::transform;
 
-   return sequence_manipulator([alloc, f=move(f)](sequence<auto> s) mutable {
-         typedef std::result_of_t<Transform(typename decltype(s)::value_type)> output_value;
+   return sequence_manipulator([alloc, f=move(f)](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::select_cursor<decltype(upstream), Transform> cursor_type;
 
-         return sequence<output_value>{std::allocator_arg, alloc, [f=move(f), s=move(s)](auto &yield) mutable {
-               transform(begin(s), end(s), sink_iterator(yield), move(f));
-            }};
+         return details_::fuse(alloc, cursor_type{move(upstream), move(f)});
       });
 }
 
 
+// Applies f to batches of `batch` elements (by default 1024 per thread) split
+// across threads, for projections expensive enough to be worth it; f must be
+// safe to call concurrently.  Results are yielded in upstream order unless
+// order is result_order::unordered.
 template<class Transform, class Alloc=std::allocator<void>>
-inline auto select_many(Transform transform, const Alloc &alloc={}) {
+inline auto parallel_select(Transform f, const parallel_policy &policy=par(0, 1), std::size_t batch=0, result_order order=result_order::preserved, const Alloc &alloc={}) {
    using std::move;
 
-   return sequence_manipulator([alloc, t=move(transform)](sequence<auto> s) mutable {
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+         typedef std::decay_t<std::result_of_t<Transform(const S &)>> result_type;
+
+         auto upstream = details_::cursor_of(move(s));
+         auto work = [f](const S &value) { return boost::optional<result_type>{f(value)}; };
+         typedef details_::parallel_map_cursor<decltype(upstream), decltype(work)> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), move(work), policy, batch, order});
+      });
+}
+
+
+template<class Transform, class Alloc=std::allocator<void>>
+inline auto select_many(Transform transform, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
+   using std::move;
+
+   return sequence_manipulator([alloc, attrs, t=move(transform)](sequence<auto> s) mutable {
          typedef typename details_::select_many_helper<typename decltype(s)::value_type,
                                                        Transform>::sequence_type sequence_type;
 
-         return sequence_type{std::allocator_arg, alloc, [s=move(s), transform=move(t)](auto &yield) mutable {
+         return sequence_type{std::allocator_arg, alloc, attrs, [s=move(s), transform=move(t)](auto &yield) mutable {
                for (const auto &s_value : s) {
                   for (auto out_value : transform(s_value)) {
                      yield(out_value);
@@ -68,9 +193,54 @@ inline auto select_many(Transform transform, const Alloc &alloc={}) {
 }
 
 
-template<class LSelector, class RSelector, class Combiner, class R, class L, class Alloc=std::allocator<R>, class Comp=std::equal_to<void>>
-inline auto join(sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, std::size_t reserve, const Alloc &alloc={}, Comp comp={}) {
-   typedef sequence<typename details_::join_helper<L, LSelector, R, RSelector, Combiner>::result_type> result_type;
+// Hash join: the right-hand rows are buffered once and indexed by key with
+// hash, and each left row probes the index, so the cost is O(n + m + matches).
+// comp is the key equality and must agree with hash.
+template<class LSelector, class RSelector, class Combiner, class R, class L, class Alloc, class Comp, class Hash,
+         class=std::enable_if_t<!std::is_convertible<Hash, const stack_attributes &>::value>>
+inline auto join(sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, std::size_t reserve, const Alloc &alloc, Comp comp, Hash hash, const stack_attributes &attrs=default_stack()) {
+   typedef details_::join_helper<L, LSelector, R, RSelector, Combiner> helper_type;
+   typedef sequence<typename helper_type::result_type> result_type;
+   typedef details_::join_index<typename helper_type::key_type, Hash, Comp, Alloc> index_type;
+
+   using std::back_inserter;
+   using std::begin;
+   using std::end;
+   using std::copy;
+   using std::move;
+
+   std::vector<R, Alloc> rhs{alloc};
+   rhs.reserve(std::max(reserve, r.size_hint().value_or(0)));
+   copy(begin(r), end(r), back_inserter(rhs));
+   index_type index{rhs, select_r, hash, comp, alloc};
+
+   return result_type(std::allocator_arg, alloc, attrs, [lhs=move(l), select_l, rhs=move(rhs), index=move(index), combine](auto &yield) mutable {
+         for (const L &l : lhs) {
+            for (std::size_t i = index.first(select_l(l)); i != index_type::npos; i = index.next(i)) {
+               yield(combine(l, rhs[i]));
+            }
+         }
+      });
+}
+
+
+namespace details_ {
+
+template<class L, class LSelector, class R, class RSelector, class Combiner, class Alloc, class Comp>
+inline auto join_on(std::true_type, sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, std::size_t reserve, const Alloc &alloc, Comp comp, const stack_attributes &attrs) {
+   typedef typename join_helper<L, LSelector, R, RSelector, Combiner>::key_type key_type;
+
+   using std::move;
+
+   return join(move(l), move(select_l), move(r), move(select_r), move(combine), reserve, alloc, move(comp), std::hash<key_type>{}, attrs);
+}
+
+
+// Any comparator other than plain equality may match keys that std::hash
+// puts apart, so it is applied to every pair of rows.
+template<class L, class LSelector, class R, class RSelector, class Combiner, class Alloc, class Comp>
+inline auto join_on(std::false_type, sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, std::size_t reserve, const Alloc &alloc, Comp comp, const stack_attributes &attrs) {
+   typedef sequence<typename join_helper<L, LSelector, R, RSelector, Combiner>::result_type> result_type;
 
    using std::back_inserter;
    using std::begin;
@@ -79,12 +249,12 @@ inline auto join(sequence<L> l, LSelector select_l, sequence<R> r, RSelector sel
    using std::move;
 
    std::vector<R, Alloc> rhs{alloc};
-   rhs.reserve(reserve);
+   rhs.reserve(std::max(reserve, r.size_hint().value_or(0)));
    copy(begin(r), end(r), back_inserter(rhs));
 
-   return result_type(std::allocator_arg, alloc, [lhs=move(l), select_l, rhs=move(rhs), select_r, combine, comp](auto &yield) mutable {
-         for (const L &l : move(lhs)) {
-            for (const R &r : move(rhs)) {
+   return result_type(std::allocator_arg, alloc, attrs, [lhs=move(l), select_l, rhs=move(rhs), select_r, combine, comp](auto &yield) mutable {
+         for (const L &l : lhs) {
+            for (const R &r : rhs) {
                if (comp(select_l(l), select_r(r))) {
                   yield(combine(l, r));
                }
@@ -93,6 +263,91 @@ inline auto join(sequence<L> l, LSelector select_l, sequence<R> r, RSelector sel
       });
 }
 
+}
+
+
+// Inner join of l and r on the keys select_l and select_r extract, pairing
+// the rows for which comp(l_key, r_key) holds, in left-then-right order.  With
+// the default std::equal_to this is a hash join on std::hash<key_type>; any
+// other comp is evaluated for every pair, since std::hash cannot be assumed to
+// agree with it.  Pass a Hash consistent with comp to hash join on a custom
+// equality.
+template<class LSelector, class RSelector, class Combiner, class R, class L, class Alloc=std::allocator<R>, class Comp=std::equal_to<void>>
+inline auto join(sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, std::size_t reserve, const Alloc &alloc={}, Comp comp={}, const stack_attributes &attrs=default_stack()) {
+   typedef typename details_::join_helper<L, LSelector, R, RSelector, Combiner>::key_type key_type;
+
+   using std::move;
+
+   return details_::join_on(details_::is_key_equality<Comp, key_type>{}, move(l), move(select_l), move(r), move(select_r), move(combine), reserve, alloc, move(comp), attrs);
+}
+
+
+// Streaming join of two sequences already ordered by key under comp.  Neither
+// input is buffered beyond the current run of equal right-hand keys.
+template<class LSelector, class RSelector, class Combiner, class R, class L, class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto merge_join(sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, Comp comp={}, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
+   typedef details_::join_helper<L, LSelector, R, RSelector, Combiner> helper_type;
+   typedef sequence<typename helper_type::result_type> result_type;
+   typedef typename helper_type::key_type key_type;
+   typedef typename Alloc::template rebind<R>::other r_alloc;
+
+   using std::begin;
+   using std::end;
+   using std::move;
+
+   return result_type(std::allocator_arg, alloc, attrs, [=, l=move(l), r=move(r)](auto &yield) mutable {
+         auto li = begin(l);
+         auto le = end(l);
+         auto ri = begin(r);
+         auto re = end(r);
+
+         std::vector<R, r_alloc> run{r_alloc{alloc}};
+         boost::optional<key_type> run_key;
+
+         for (; li != le; ++li) {
+            const L &l_value = *li;
+            key_type l_key = select_l(l_value);
+
+            if (!run.empty()) {
+               if (comp(l_key, *run_key)) {
+                  continue;
+               }
+               if (!comp(*run_key, l_key)) {
+                  for (const R &r_value : run) {
+                     yield(combine(l_value, r_value));
+                  }
+                  continue;
+               }
+               run.clear();
+            }
+
+            for (; ri != re && comp(select_r(*ri), l_key); ++ri) {}
+            if (ri == re) {
+               break;
+            }
+            if (comp(l_key, select_r(*ri))) {
+               continue;
+            }
+
+            run_key = select_r(*ri);
+            for (; ri != re && !comp(*run_key, select_r(*ri)); ++ri) {
+               run.push_back(*ri);
+            }
+            for (const R &r_value : run) {
+               yield(combine(l_value, r_value));
+            }
+         }
+      });
+}
+
+
+template<class LSelector, class RSelector, class Combiner, class R, class L, class Comp=std::less<void>, class Alloc=std::allocator<void>>
+inline auto join(sorted_inputs_t, sequence<L> l, LSelector select_l, sequence<R> r, RSelector select_r, Combiner combine, Comp comp={}, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
+   using std::move;
+
+   return merge_join(move(l), move(select_l), move(r), move(select_r), move(combine), move(comp), alloc, attrs);
+}
+
 
 template<class Apply>
 inline auto for_each(Apply apply) {
@@ -101,9 +356,104 @@ inline auto for_each(Apply apply) {
    using std::for_each;
    using std::move;
 
-   return sequence_manipulator([apply=move(apply)](sequence<auto> s) mutable {
+   return sequence_manipulator([apply=move(apply)](auto s) mutable {
          return for_each(begin(s), end(s), apply);
       });
 }
 
+
+// Reads the sequence on the calling thread in chunks of `grain` elements and
+// applies apply to each chunk on the policy's executor, keeping at most
+// policy.concurrency() chunks in flight; the last, partial chunk runs on the
+// calling thread.  apply must be safe to call concurrently, and elements are
+// visited in no particular order.  Returns once every dispatched chunk has
+// finished, rethrowing the first exception thrown by apply or the upstream
+// (no further chunks are dispatched after it).
+template<class Apply>
+inline auto parallel_for_each(Apply apply, std::size_t grain=1024, const parallel_policy &policy=par(0, 1)) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+
+         auto e = details_::executor_of(policy);
+         const std::size_t limit = policy.concurrency();
+         const std::size_t chunk_size = std::max<std::size_t>(grain, 1);
+         std::mutex mutex;
+         std::condition_variable changed;
+         std::size_t in_flight = 0;
+         std::exception_ptr error;
+
+         auto visit = [&](const std::vector<S> &chunk) {
+               try {
+                  for (const S &value : chunk) {
+                     apply(value);
+                  }
+               }
+               catch (...) {
+                  std::lock_guard<std::mutex> lock{mutex};
+                  if (!error) {
+                     error = std::current_exception();
+                  }
+               }
+            };
+
+         // Dispatched chunks refer to this frame, so whatever is thrown here is
+         // only rethrown once they have all finished.
+         try {
+            std::vector<S> chunk;
+            chunk.reserve(chunk_size);
+            for (auto i = s.begin(); i != s.end(); ++i) {
+               chunk.push_back(*i);
+               if (chunk.size() < chunk_size) {
+                  continue;
+               }
+
+               details_::help_until(*e, mutex, changed, [&] { return in_flight < limit || error; });
+               {
+                  std::lock_guard<std::mutex> lock{mutex};
+                  if (error) {
+                     break;
+                  }
+                  ++in_flight;
+               }
+               try {
+                  e->execute([&, chunk=move(chunk)] {
+                        visit(chunk);
+                        std::lock_guard<std::mutex> lock{mutex};
+                        --in_flight;
+                        changed.notify_all();
+                     });
+               }
+               catch (...) {
+                  std::lock_guard<std::mutex> lock{mutex};
+                  --in_flight;
+                  throw;
+               }
+               chunk = std::vector<S>{};
+               chunk.reserve(chunk_size);
+            }
+
+            bool failed;
+            {
+               std::lock_guard<std::mutex> lock{mutex};
+               failed = static_cast<bool>(error);
+            }
+            if (!failed) {
+               visit(chunk);
+            }
+         }
+         catch (...) {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (!error) {
+               error = std::current_exception();
+            }
+         }
+         details_::help_until(*e, mutex, changed, [&] { return in_flight == 0; });
+         if (error) {
+            std::rethrow_exception(error);
+         }
+      });
+}
+
 #endif
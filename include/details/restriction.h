@@ -6,18 +6,78 @@
 #endif
 
 
+namespace details_ {
+
+template<class Upstream, class Predicate>
+class where_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline where_cursor(Upstream &&u, Predicate p) :
+      upstream(std::move(u)),
+      p(std::move(p))
+   {
+      seek();
+   }
+
+   inline bool done() const {
+      return upstream.done();
+   }
+
+   inline const value_type & current() const {
+      return upstream.current();
+   }
+
+   inline void advance() {
+      upstream.advance();
+      seek();
+   }
+
+private:
+   inline void seek() {
+      for (std::size_t skipped = 1; !upstream.done() && !p(upstream.current()); ++skipped) {
+         if (skipped % 1024 == 0) {
+            cancellation::poll();
+         }
+         upstream.advance();
+      }
+   }
+
+   Upstream upstream;
+   Predicate p;
+};
+
+}
+
+
 template<class Predicate, class Alloc=std::allocator<void>>
 inline auto where(Predicate p, const Alloc &alloc={}) {
    using std::move;
 
-   return sequence_manipulator([=](sequence<auto> s) mutable {
-         return decltype(s){std::allocator_arg, alloc, [p, s=move(s)](auto &yield) mutable {
-               for (const auto &element : s) {
-                  if (p(element)) {
-                     yield(element);
-                  }
-               }
-            }};
+   return sequence_manipulator([=](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::where_cursor<decltype(upstream), Predicate> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), p});
+      });
+}
+
+
+// Evaluates p over batches of `batch` elements (by default 1024 per thread)
+// split across threads; p must be safe to call concurrently.  Matches are
+// yielded in upstream order unless order is result_order::unordered.
+template<class Predicate, class Alloc=std::allocator<void>>
+inline auto parallel_where(Predicate p, const parallel_policy &policy=par(0, 1), std::size_t batch=0, result_order order=result_order::preserved, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         typedef typename decltype(s)::value_type S;
+
+         auto upstream = details_::cursor_of(move(s));
+         auto work = [p](const S &value) { return p(value) ? boost::optional<S>{value} : boost::none; };
+         typedef details_::parallel_map_cursor<decltype(upstream), decltype(work)> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), move(work), policy, batch, order});
       });
 }
 
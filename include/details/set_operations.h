@@ -7,54 +7,240 @@
 
 
 template<class T, class Comp=std::less<void>, class Alloc=std::allocator<void>>
-inline auto union_with(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}) {
+inline auto union_with(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::begin;
    using std::end;
    using std::move;
    using std::set_union;
 
-   return sequence<T>{std::allocator_arg, alloc, [l=move(l), r=move(r), comp](auto &yield) mutable {
+   return sequence<T>{std::allocator_arg, alloc, attrs, [l=move(l), r=move(r), comp](auto &yield) mutable {
          set_union(begin(l), end(l), begin(r), end(r), sink_iterator(yield), comp);
       }};
 }
 
 
 template<class T, class Comp=std::less<void>, class Alloc=std::allocator<void>>
-inline auto intersect_with(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}) {
+inline auto intersect_with(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::begin;
    using std::end;
    using std::move;
    using std::set_intersection;
 
-   return sequence<T>{std::allocator_arg, alloc, [l=move(l), r=move(r), comp](auto &yield) mutable {
+   return sequence<T>{std::allocator_arg, alloc, attrs, [l=move(l), r=move(r), comp](auto &yield) mutable {
          set_intersection(begin(l), end(l), begin(r), end(r), sink_iterator(yield), comp);
       }};
 }
 
 
 template<class T, class Comp=std::less<void>, class Alloc=std::allocator<void>>
-inline auto except(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}) {
+inline auto except(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::begin;
    using std::end;
    using std::move;
    using std::set_difference;
 
-   return sequence<T>{std::allocator_arg, alloc, [l=move(l), r=move(r), comp](auto &yield) mutable {
+   return sequence<T>{std::allocator_arg, alloc, attrs, [l=move(l), r=move(r), comp](auto &yield) mutable {
          set_difference(begin(l), end(l), begin(r), end(r), sink_iterator(yield), comp);
       }};
 }
 
 
 template<class T, class Comp=std::less<void>, class Alloc=std::allocator<void>>
-inline auto symmetric_difference(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}) {
+inline auto symmetric_difference(sequence<T> l, sequence<T> r, Comp comp={}, const Alloc &alloc={}, const stack_attributes &attrs=default_stack()) {
    using std::begin;
    using std::end;
    using std::move;
    using std::set_symmetric_difference;
 
-   return sequence<T>{std::allocator_arg, alloc, [l=move(l), r=move(r), comp](auto &yield) mutable {
+   return sequence<T>{std::allocator_arg, alloc, attrs, [l=move(l), r=move(r), comp](auto &yield) mutable {
          set_symmetric_difference(begin(l), end(l), begin(r), end(r), sink_iterator(yield), comp);
       }};
 }
 
+namespace details_ {
+
+// Open-addressing (linear probing) set of the distinct values seen so far.
+// Values live densely in insertion order; the probe table holds their cached
+// hash and position, and is kept at most half full.  Hashes are scrambled
+// (Fibonacci hashing) and the table indexed by their high bits, since
+// std::hash is the identity for integers and keys differing only in high bits
+// would otherwise share one probe chain.
+template<class T, class Hash, class KeyEqual, class Alloc>
+class open_hash_set {
+   struct slot {
+      std::uint64_t hash;
+      std::size_t position;
+   };
+
+   typedef std::vector<T, typename Alloc::template rebind<T>::other> values_type;
+   typedef std::vector<slot, typename Alloc::template rebind<slot>::other> slots_type;
+
+   static constexpr std::size_t empty_slot = static_cast<std::size_t>(-1);
+
+public:
+   inline open_hash_set(const Hash &hash, const KeyEqual &equal, const Alloc &alloc) :
+      hash(hash),
+      equal(equal),
+      values(typename values_type::allocator_type{alloc}),
+      slots(16, slot{0, empty_slot}, typename slots_type::allocator_type{alloc}),
+      shift{64 - 4}
+   {
+   }
+
+   // Returns true if t was not already present.
+   inline bool insert(const T &t) {
+      const std::uint64_t h = static_cast<std::uint64_t>(hash(t)) * 0x9E3779B97F4A7C15ull;
+      const std::size_t mask = slots.size() - 1;
+
+      for (std::size_t i = static_cast<std::size_t>(h >> shift);; i = (i + 1) & mask) {
+         slot &candidate = slots[i];
+         if (candidate.position == empty_slot) {
+            candidate = slot{h, values.size()};
+            values.push_back(t);
+            if (slots.size() < 2 * values.size()) {
+               grow();
+            }
+            return true;
+         }
+         if (candidate.hash == h && equal(values[candidate.position], t)) {
+            return false;
+         }
+      }
+   }
+
+private:
+   inline void grow() {
+      slots_type grown(2 * slots.size(), slot{0, empty_slot}, slots.get_allocator());
+      const std::size_t mask = grown.size() - 1;
+      --shift;
+
+      for (const slot &s : slots) {
+         if (s.position != empty_slot) {
+            std::size_t i = static_cast<std::size_t>(s.hash >> shift);
+            while (grown[i].position != empty_slot) {
+               i = (i + 1) & mask;
+            }
+            grown[i] = s;
+         }
+      }
+      slots.swap(grown);
+   }
+
+   Hash hash;
+   KeyEqual equal;
+   values_type values;
+   slots_type slots;
+   unsigned shift;
+};
+
+
+template<class T, class Hash, class KeyEqual, class Alloc>
+constexpr std::size_t open_hash_set<T, Hash, KeyEqual, Alloc>::empty_slot;
+
+
+template<class Upstream, class Hash, class KeyEqual, class Alloc>
+class distinct_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline distinct_cursor(Upstream &&u, const Hash &hash, const KeyEqual &equal, const Alloc &alloc) :
+      upstream(std::move(u)),
+      seen(hash, equal, alloc)
+   {
+      seek();
+   }
+
+   inline bool done() const {
+      return upstream.done();
+   }
+
+   inline const value_type & current() const {
+      return upstream.current();
+   }
+
+   inline void advance() {
+      upstream.advance();
+      seek();
+   }
+
+private:
+   inline void seek() {
+      while (!upstream.done() && !seen.insert(upstream.current())) {
+         upstream.advance();
+      }
+   }
+
+   Upstream upstream;
+   open_hash_set<value_type, Hash, KeyEqual, Alloc> seen;
+};
+
+
+// Distinct over sorted input only has to remember the previous element.
+template<class Upstream, class KeyEqual>
+class adjacent_distinct_cursor {
+public:
+   typedef typename Upstream::value_type value_type;
+
+   inline adjacent_distinct_cursor(Upstream &&u, KeyEqual equal) :
+      upstream(std::move(u)),
+      equal(std::move(equal))
+   {
+      remember();
+   }
+
+   inline bool done() const {
+      return upstream.done();
+   }
+
+   inline const value_type & current() const {
+      return upstream.current();
+   }
+
+   inline void advance() {
+      do {
+         upstream.advance();
+      } while (!upstream.done() && equal(*previous, upstream.current()));
+      remember();
+   }
+
+private:
+   inline void remember() {
+      if (!upstream.done()) {
+         previous = upstream.current();
+      }
+   }
+
+   Upstream upstream;
+   KeyEqual equal;
+   boost::optional<value_type> previous;
+};
+
+}
+
+
+template<class Alloc=std::allocator<void>, class Hash=details_::default_hash, class KeyEqual=std::equal_to<void>>
+inline auto distinct(const Alloc &alloc={}, Hash hash={}, KeyEqual equal={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::distinct_cursor<decltype(upstream), Hash, KeyEqual, Alloc> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), hash, equal, alloc});
+      });
+}
+
+
+template<class KeyEqual=std::equal_to<void>, class Alloc=std::allocator<void>>
+inline auto distinct(sorted_inputs_t, KeyEqual equal={}, const Alloc &alloc={}) {
+   using std::move;
+
+   return sequence_manipulator([=](auto s) mutable {
+         auto upstream = details_::cursor_of(move(s));
+         typedef details_::adjacent_distinct_cursor<decltype(upstream), KeyEqual> cursor_type;
+
+         return details_::fuse(alloc, cursor_type{move(upstream), equal});
+      });
+}
+
 #endif
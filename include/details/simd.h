@@ -0,0 +1,370 @@
+#ifndef SEQUENCE_SIMD_H__
+#define SEQUENCE_SIMD_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+
+namespace details_ {
+
+// Kernels over contiguous arrays of arithmetic values, used by the aggregates
+// when they are handed a pointer range (see details_::reduce).  With GCC and
+// Clang the kernels are written against 32 byte vector extensions; on x86
+// they are compiled once for AVX2 and once for the baseline instruction set
+// (SSE2 on x86-64), and the AVX2 build is picked at run time when the CPU
+// supports it.  Other compilers get plain loops.
+//
+// Vectorized sums reassociate floating point additions, and min/max do not
+// preserve which of several equal elements (e.g. 0.0 and -0.0) is returned.
+
+template<class T>
+struct is_vectorizable : std::integral_constant<bool,
+   (std::is_integral<T>::value && !std::is_same<T, bool>::value) || std::is_same<T, float>::value || std::is_same<T, double>::value> {
+};
+
+
+template<class T, class Op, template<class> class Standard>
+struct is_standard_operation : std::integral_constant<bool, std::is_same<Op, Standard<void>>::value || std::is_same<Op, Standard<T>>::value> {
+};
+
+
+#if defined(__GNUC__)
+
+#define SEQUENCING_KERNEL inline __attribute__((always_inline))
+
+template<class T>
+struct simd {
+   typedef T type __attribute__((vector_size(32)));
+   static constexpr std::size_t lanes = 32 / sizeof(T);
+
+   // Vectors are passed by reference: returning them by value from a function
+   // compiled without AVX would change the ABI.
+   static SEQUENCING_KERNEL void load(type &v, const T *p) {
+      std::memcpy(&v, p, sizeof v);
+   }
+
+   static SEQUENCING_KERNEL void broadcast(type &v, T t) {
+      for (std::size_t i = 0; i < lanes; ++i) {
+         v[i] = t;
+      }
+   }
+};
+
+
+template<class T>
+SEQUENCING_KERNEL T sum_kernel(const T *p, std::size_t n, T init) {
+   typedef simd<T> V;
+
+   typename V::type acc;
+   typename V::type v;
+   V::broadcast(acc, T{0});
+   std::size_t i = 0;
+   for (; i + V::lanes <= n; i += V::lanes) {
+      V::load(v, p + i);
+      acc += v;
+   }
+
+   T total = init;
+   for (std::size_t lane = 0; lane < V::lanes; ++lane) {
+      total += acc[lane];
+   }
+   for (; i < n; ++i) {
+      total += p[i];
+   }
+   return total;
+}
+
+
+// Minimum and maximum of n > 0 elements.
+template<class T>
+SEQUENCING_KERNEL std::pair<T, T> minmax_kernel(const T *p, std::size_t n) {
+   typedef simd<T> V;
+
+   std::pair<T, T> result{p[0], p[0]};
+   std::size_t i = 0;
+   if (n >= V::lanes) {
+      typename V::type lo;
+      typename V::type v;
+      V::load(lo, p);
+      typename V::type hi = lo;
+      for (i = V::lanes; i + V::lanes <= n; i += V::lanes) {
+         V::load(v, p + i);
+         lo = v < lo ? v : lo;
+         hi = hi < v ? v : hi;
+      }
+      for (std::size_t lane = 0; lane < V::lanes; ++lane) {
+         result.first = lo[lane] < result.first ? lo[lane] : result.first;
+         result.second = result.second < hi[lane] ? hi[lane] : result.second;
+      }
+   }
+   for (; i < n; ++i) {
+      result.first = p[i] < result.first ? p[i] : result.first;
+      result.second = result.second < p[i] ? p[i] : result.second;
+   }
+   return result;
+}
+
+
+template<class T>
+SEQUENCING_KERNEL bool contains_kernel(const T *p, std::size_t n, T t) {
+   typedef simd<T> V;
+   constexpr std::size_t block = 8 * V::lanes;
+
+   typename V::type target;
+   typename V::type v;
+   V::broadcast(target, t);
+   std::size_t i = 0;
+   for (; i + block <= n; i += block) {
+      // Lanes are all ones where equal, so OR-ing the masks of a block and
+      // testing its lanes once costs little over the comparisons themselves.
+      V::load(v, p + i);
+      auto hits = v == target;
+      for (std::size_t j = V::lanes; j < block; j += V::lanes) {
+         V::load(v, p + i + j);
+         hits |= v == target;
+      }
+      for (std::size_t lane = 0; lane < V::lanes; ++lane) {
+         if (hits[lane]) {
+            return true;
+         }
+      }
+   }
+   for (; i < n; ++i) {
+      if (p[i] == t) {
+         return true;
+      }
+   }
+   return false;
+}
+
+#undef SEQUENCING_KERNEL
+
+#else
+
+template<class T>
+inline T sum_kernel(const T *p, std::size_t n, T init) {
+   return std::accumulate(p, p + n, init);
+}
+
+
+template<class T>
+inline std::pair<T, T> minmax_kernel(const T *p, std::size_t n) {
+   auto result = std::minmax_element(p, p + n);
+   return std::pair<T, T>{*result.first, *result.second};
+}
+
+
+template<class T>
+inline bool contains_kernel(const T *p, std::size_t n, T t) {
+   return std::find(p, p + n, t) != p + n;
+}
+
+#endif
+
+
+template<class T, class Predicate>
+inline std::size_t count_kernel(const T *p, std::size_t n, Predicate &pred) {
+   std::size_t count = 0;
+   for (std::size_t i = 0; i < n; ++i) {
+      count += pred(p[i]) ? 1 : 0;
+   }
+   return count;
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+inline bool has_avx2() {
+   // __builtin_cpu_supports may run before the CPU model is initialised (e.g.
+   // from a static constructor), so initialise it explicitly first.
+   static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+   return avx2;
+}
+
+
+template<class T>
+__attribute__((target("avx2"))) T sum_avx2(const T *p, std::size_t n, T init) {
+   return sum_kernel(p, n, init);
+}
+
+
+template<class T>
+__attribute__((target("avx2"))) std::pair<T, T> minmax_avx2(const T *p, std::size_t n) {
+   return minmax_kernel(p, n);
+}
+
+
+template<class T>
+__attribute__((target("avx2"))) bool contains_avx2(const T *p, std::size_t n, T t) {
+   return contains_kernel(p, n, t);
+}
+
+
+// The predicate is inlined into this clone, letting simple ones vectorize.
+template<class T, class Predicate>
+__attribute__((target("avx2"))) std::size_t count_avx2(const T *p, std::size_t n, Predicate &pred) {
+   return count_kernel(p, n, pred);
+}
+
+
+template<class T>
+inline T simd_sum(const T *p, std::size_t n, T init) {
+   return has_avx2() ? sum_avx2(p, n, init) : sum_kernel(p, n, init);
+}
+
+
+template<class T>
+inline std::pair<T, T> simd_minmax(const T *p, std::size_t n) {
+   return has_avx2() ? minmax_avx2(p, n) : minmax_kernel(p, n);
+}
+
+
+template<class T>
+inline bool simd_contains(const T *p, std::size_t n, T t) {
+   return has_avx2() ? contains_avx2(p, n, t) : contains_kernel(p, n, t);
+}
+
+
+template<class T, class Predicate>
+inline std::size_t simd_count(const T *p, std::size_t n, Predicate &pred) {
+   return has_avx2() ? count_avx2(p, n, pred) : count_kernel(p, n, pred);
+}
+
+#else
+
+template<class T>
+inline T simd_sum(const T *p, std::size_t n, T init) {
+   return sum_kernel(p, n, init);
+}
+
+
+template<class T>
+inline std::pair<T, T> simd_minmax(const T *p, std::size_t n) {
+   return minmax_kernel(p, n);
+}
+
+
+template<class T>
+inline bool simd_contains(const T *p, std::size_t n, T t) {
+   return contains_kernel(p, n, t);
+}
+
+
+template<class T, class Predicate>
+inline std::size_t simd_count(const T *p, std::size_t n, Predicate &pred) {
+   return count_kernel(p, n, pred);
+}
+
+#endif
+
+
+// Range helpers behind the aggregates.  The generic forms are the plain loops;
+// the pointer forms take over for arithmetic elements and standard operators.
+template<class Iterator, class T, class Add>
+inline T sum_range(Iterator i, Iterator e, T init, Add &add) {
+   return std::accumulate(i, e, init, add);
+}
+
+
+template<class T, class Add, class=std::enable_if_t<is_vectorizable<T>::value && is_standard_operation<T, Add, std::plus>::value>>
+inline T sum_range(const T *i, const T *e, T init, Add &) {
+   return simd_sum(i, static_cast<std::size_t>(e - i), init);
+}
+
+
+// Extremes of a non-empty range; the first of equal elements is kept.
+template<class Iterator, class Comp>
+inline auto minmax_range(Iterator i, Iterator e, Comp &comp) {
+   typedef typename std::iterator_traits<Iterator>::value_type S;
+
+   S min_result{*i};
+   S max_result{*i};
+   for (++i; i != e; ++i) {
+      if (comp(*i, min_result)) {
+         min_result = *i;
+      }
+      else if (comp(max_result, *i)) {
+         max_result = *i;
+      }
+   }
+
+   return std::make_pair(min_result, max_result);
+}
+
+
+template<class T, class Comp, class=std::enable_if_t<is_vectorizable<T>::value && is_standard_operation<T, Comp, std::less>::value>>
+inline std::pair<T, T> minmax_range(const T *i, const T *e, Comp &) {
+   return simd_minmax(i, static_cast<std::size_t>(e - i));
+}
+
+
+template<class Iterator, class Comp>
+inline auto min_range(Iterator i, Iterator e, Comp &comp) {
+   typedef typename std::iterator_traits<Iterator>::value_type S;
+
+   S result{*i};
+   for (++i; i != e; ++i) {
+      if (comp(*i, result)) {
+         result = *i;
+      }
+   }
+
+   return result;
+}
+
+
+template<class T, class Comp, class=std::enable_if_t<is_vectorizable<T>::value && is_standard_operation<T, Comp, std::less>::value>>
+inline T min_range(const T *i, const T *e, Comp &) {
+   return simd_minmax(i, static_cast<std::size_t>(e - i)).first;
+}
+
+
+template<class Iterator, class Comp>
+inline auto max_range(Iterator i, Iterator e, Comp &comp) {
+   typedef typename std::iterator_traits<Iterator>::value_type S;
+
+   S result{*i};
+   for (++i; i != e; ++i) {
+      if (comp(result, *i)) {
+         result = *i;
+      }
+   }
+
+   return result;
+}
+
+
+template<class T, class Comp, class=std::enable_if_t<is_vectorizable<T>::value && is_standard_operation<T, Comp, std::less>::value>>
+inline T max_range(const T *i, const T *e, Comp &) {
+   return simd_minmax(i, static_cast<std::size_t>(e - i)).second;
+}
+
+
+template<class Iterator, class Predicate>
+inline std::size_t count_range(Iterator i, Iterator e, Predicate &p) {
+   return static_cast<std::size_t>(std::count_if(i, e, p));
+}
+
+
+template<class T, class Predicate, class=std::enable_if_t<is_vectorizable<T>::value>>
+inline std::size_t count_range(const T *i, const T *e, Predicate &p) {
+   return simd_count(i, static_cast<std::size_t>(e - i), p);
+}
+
+
+template<class Iterator, class T>
+inline bool contains_range(Iterator i, Iterator e, const T &t) {
+   return std::find(i, e, t) != e;
+}
+
+
+template<class S, class T, class=std::enable_if_t<is_vectorizable<S>::value && std::is_arithmetic<T>::value &&
+                                                std::is_same<std::common_type_t<S, T>, S>::value>>
+inline bool contains_range(const S *i, const S *e, const T &t) {
+   return simd_contains(i, static_cast<std::size_t>(e - i), static_cast<S>(t));
+}
+
+}
+
+#endif
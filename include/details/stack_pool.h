@@ -0,0 +1,243 @@
+#ifndef SEQUENCE_STACK_POOL_H__
+#define SEQUENCE_STACK_POOL_H__
+
+#ifndef SEQUENCING_SEQUENCE_H__
+#error This file is meant to be included from sequence.h
+#endif
+
+
+struct stack_pool_statistics {
+   std::size_t hits;
+   std::size_t misses;
+};
+
+
+// Per-thread cache of coroutine stacks.  Every generator-backed sequence takes
+// its stack from the pool of the thread constructing it and hands it back to
+// the pool of the thread destroying it, so short-lived pipelines reuse stacks
+// rather than allocating a fresh one per stage.  Stacks of different sizes
+// (see stack_attributes) share the pool.
+class stack_pool {
+   typedef boost::coroutines::stack_allocator::traits_type traits_type;
+
+public:
+   stack_pool() :
+      size{traits_type::default_size()},
+      max_stacks{16},
+      stats{0, 0}
+   {
+   }
+
+   stack_pool(const stack_pool &) = delete;
+   stack_pool & operator =(const stack_pool &) = delete;
+
+   inline ~stack_pool() {
+      trim();
+      destroyed() = true;
+   }
+
+   static inline stack_pool & local() {
+      static thread_local stack_pool pool;
+      return pool;
+   }
+
+   // False once the calling thread's pool has been torn down (e.g. while
+   // sequences with static storage duration are being destroyed).
+   static inline bool available() noexcept {
+      return !destroyed();
+   }
+
+   // Smallest stack the pool hands out: Boost's own minimum, and never less
+   // than the guard page plus one usable page.
+   static inline std::size_t minimum_stack_size() noexcept {
+      return std::max<std::size_t>(traits_type::minimum_size(), 2 * page_size());
+   }
+
+   // Stacks are whole pages; requested sizes are rounded up to one.
+   static inline std::size_t page_size() noexcept {
+      return traits_type::page_size();
+   }
+
+   static inline std::size_t rounded(std::size_t stack_size) noexcept {
+      return (stack_size + page_size() - 1) / page_size() * page_size();
+   }
+
+   inline void configure(std::size_t stack_size, std::size_t capacity) {
+      check_size(stack_size);
+      size = stack_size;
+      max_stacks = capacity;
+      trim(max_stacks);
+   }
+
+   inline std::size_t stack_size() const noexcept {
+      return size;
+   }
+
+   inline std::size_t capacity() const noexcept {
+      return max_stacks;
+   }
+
+   inline std::size_t cached() const noexcept {
+      return stacks.size();
+   }
+
+   inline stack_pool_statistics statistics() const noexcept {
+      return stats;
+   }
+
+   inline void reset_statistics() noexcept {
+      stats = {0, 0};
+   }
+
+   inline void allocate(boost::coroutines::stack_context &ctx, std::size_t stack_size) {
+      stack_size = rounded(stack_size);
+
+      // Most recently returned stacks are the most likely to still be cached.
+      for (auto i = stacks.rbegin(); i != stacks.rend(); ++i) {
+         if (i->size == stack_size) {
+            ctx = *i;
+            stacks.erase(std::next(i).base());
+            ++stats.hits;
+            return;
+         }
+      }
+
+      allocate_stack(ctx, stack_size);
+      ++stats.misses;
+   }
+
+   inline void deallocate(boost::coroutines::stack_context &ctx) {
+      if (stacks.size() < max_stacks) {
+         stacks.push_back(ctx);
+      }
+      else {
+         release_stack(ctx);
+      }
+   }
+
+   inline void trim(std::size_t n=0) {
+      while (n < stacks.size()) {
+         release_stack(stacks.front());
+         stacks.erase(stacks.begin());
+      }
+   }
+
+   static inline void check_size(std::size_t stack_size) {
+      if (stack_size < minimum_stack_size() ||
+          (!traits_type::is_unbounded() && traits_type::maximum_size() < stack_size)) {
+         throw std::domain_error("Stack size is outside of the supported range.");
+      }
+   }
+
+   // Maps a stack whose lowest page is a PROT_NONE guard, as Boost's
+   // protected_stack_allocator does, so that an overflow faults rather than
+   // silently corrupting the neighbouring heap.  Pooled stacks keep their
+   // guard page while cached.
+   static inline void allocate_stack(boost::coroutines::stack_context &ctx, std::size_t stack_size) {
+      stack_size = rounded(stack_size);
+#if defined(__unix__) || defined(__APPLE__)
+      void *limit = ::mmap(nullptr, stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+      if (limit == MAP_FAILED) {
+         throw std::bad_alloc();
+      }
+      if (::mprotect(limit, page_size(), PROT_NONE) != 0) {
+         ::munmap(limit, stack_size);
+         throw std::bad_alloc();
+      }
+#else
+      void *limit = std::malloc(stack_size);
+      if (!limit) {
+         throw std::bad_alloc();
+      }
+#endif
+
+      ctx.size = stack_size;
+      ctx.sp = static_cast<char *>(limit) + stack_size;
+#if defined(BOOST_USE_VALGRIND)
+      ctx.valgrind_stack_id = VALGRIND_STACK_REGISTER(ctx.sp, limit);
+#endif
+   }
+
+   static inline void release_stack(boost::coroutines::stack_context &ctx) noexcept {
+#if defined(BOOST_USE_VALGRIND)
+      VALGRIND_STACK_DEREGISTER(ctx.valgrind_stack_id);
+#endif
+      void *limit = static_cast<char *>(ctx.sp) - ctx.size;
+#if defined(__unix__) || defined(__APPLE__)
+      ::munmap(limit, ctx.size);
+#else
+      std::free(limit);
+#endif
+   }
+
+private:
+   static inline bool & destroyed() noexcept {
+      static thread_local bool flag = false;
+      return flag;
+   }
+
+   std::size_t size;
+   std::size_t max_stacks;
+   stack_pool_statistics stats;
+   std::vector<boost::coroutines::stack_context> stacks;
+};
+
+
+// Boost.Coroutine StackAllocator drawing from the calling thread's stack_pool.
+struct pooled_stack_allocator {
+   typedef boost::coroutines::stack_allocator::traits_type traits_type;
+
+   static inline std::size_t stack_size() {
+      return stack_pool::available() ? stack_pool::local().stack_size() : traits_type::default_size();
+   }
+
+   inline void allocate(boost::coroutines::stack_context &ctx, std::size_t size) {
+      if (stack_pool::available()) {
+         stack_pool::local().allocate(ctx, size);
+      }
+      else {
+         stack_pool::allocate_stack(ctx, size);
+      }
+   }
+
+   inline void deallocate(boost::coroutines::stack_context &ctx) {
+      if (stack_pool::available()) {
+         stack_pool::local().deallocate(ctx);
+      }
+      else {
+         stack_pool::release_stack(ctx);
+      }
+   }
+};
+
+
+// Coroutine attributes accepted by sequence's constructor and by every
+// operator that runs a generator (pairwise, reverse, sort_by, select_many,
+// join, the set operations, broadcast).  Operators built on cursors (where,
+// select, take, sort, zip_with, concat, ...) never create a coroutine and so
+// take no attributes.
+typedef boost::coroutines::attributes stack_attributes;
+
+
+// Uses the stack size configured on the calling thread's stack_pool.
+inline stack_attributes default_stack() {
+   return stack_attributes{pooled_stack_allocator::stack_size()};
+}
+
+
+// Enough for generators that only shuffle elements between sequences.  User
+// callbacks invoked from such a generator (including the predicates and
+// projections of a fused upstream) run on this stack too, so it leaves room
+// for a few frames of library code (allocation, exception unwinding) besides
+// the guard page.
+inline stack_attributes small_stack() {
+   return stack_attributes{std::max<std::size_t>(32 * 1024, stack_pool::minimum_stack_size())};
+}
+
+
+inline stack_attributes stack_of(std::size_t size) {
+   stack_pool::check_size(size);
+   return stack_attributes{size};
+}
+
+#endif
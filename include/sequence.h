@@ -5,57 +5,311 @@
 #pragma GCC diagnostic ignored "-Wextra"
 #include <boost/coroutine/coroutine.hpp>
 #pragma GCC diagnostic pop
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(BOOST_USE_VALGRIND)
+#include <valgrind/valgrind.h>
+#endif
 
 
 namespace sequencing {
 
 template<class> class sequence;
+template<class> class fused_sequence;
+
+
+#include "details/parallel.h"
+#include "details/simd.h"
+#include "details/stack_pool.h"
 
 
-#if 0
+namespace details_ {
+
+// Type-erased producer behind every sequence.  A source always refers to its
+// current element (or nullptr once exhausted) so that begin() can be called
+// repeatedly to resume where the previous iteration stopped.
 template<class T>
-class sequence_iterator : public std::iterator<std::input_iterator_tag, T> {
-   friend class sequence<T>;
-   typedef typename boost::coroutines::asymmetric_coroutine<T>::push_type coro_t;
-   typedef decltype(boost::begin(std::declval<coro_t &>())) base_iterator;
+class sequence_source {
+public:
+   virtual ~sequence_source() = default;
+
+   virtual const T * get() const = 0;
+   virtual const T * next() = 0;
+
+   // Number of elements left (including the current one), for sources that
+   // know it without iterating.
+   virtual boost::optional<std::size_t> remaining() const {
+      return boost::none;
+   }
+
+   // Upper bound on remaining(), for sources that know one.
+   virtual boost::optional<std::size_t> size_hint() const {
+      return remaining();
+   }
+
+   // Moves past the next n elements, or to the end if there are fewer.
+   virtual const T * skip(std::size_t n) {
+      const T *value = get();
+      for (; value && n > 0; --n) {
+         value = next();
+      }
+      return value;
+   }
+};
+
+
+// Source backed by a user-supplied generator lambda.  This is the only place a
+// coroutine (and hence a separate stack) is created; the stack comes from the
+// constructing thread's stack_pool.
+template<class T>
+class coroutine_source final : public sequence_source<T> {
+   typedef typename boost::coroutines::asymmetric_coroutine<T>::pull_type coro_t;
 
 public:
-   inline T operator*() {
-      return iter.operator*();
+   template<class Fun>
+   inline coroutine_source(const stack_attributes &attrs, Fun &&f) :
+      coro{std::move(f), attrs, pooled_stack_allocator{}}
+   {
    }
 
-   inline sequence_iterator<T> & operator++() {
-      ++iter;
+   const T * get() const override {
+      return coro ? &*typename coro_t::const_iterator{&coro} : nullptr;
+   }
+
+   const T * next() override {
+      coro();
+      return get();
+   }
+
+private:
+   coro_t coro;
+};
+
+
+// Source backed by a statically typed cursor.  A cursor models:
+//
+//    typedef ... value_type;
+//    bool done() const;
+//    const value_type & current() const;
+//    void advance();
+//
+// Cursors are primed on construction (mirroring a freshly constructed
+// coroutine) and advance() is never called once done() holds.  Cursors over
+// random-access storage additionally model:
+//
+//    std::size_t remaining() const;
+//    void advance(std::size_t n);   // n <= remaining()
+template<class Cursor, class=void>
+struct is_random_access_cursor : std::false_type {
+};
+
+
+template<class Cursor>
+struct is_random_access_cursor<Cursor, decltype(void(std::declval<const Cursor &>().remaining()), void(std::declval<Cursor &>().advance(std::size_t{})))> :
+   std::true_type {
+};
+
+
+template<class Cursor>
+inline std::enable_if_t<is_random_access_cursor<Cursor>::value, boost::optional<std::size_t>> remaining_of(const Cursor &c) {
+   return c.remaining();
+}
+
+
+template<class Cursor>
+inline std::enable_if_t<!is_random_access_cursor<Cursor>::value, boost::optional<std::size_t>> remaining_of(const Cursor &) {
+   return boost::none;
+}
+
+
+// Cursors that cannot count their elements may still bound them:
+//
+//    boost::optional<std::size_t> size_hint() const;
+template<class Cursor, class=void>
+struct has_size_hint : std::false_type {
+};
+
+
+template<class Cursor>
+struct has_size_hint<Cursor, decltype(void(std::declval<const Cursor &>().size_hint()))> : std::true_type {
+};
+
+
+template<class Cursor>
+inline std::enable_if_t<has_size_hint<Cursor>::value, boost::optional<std::size_t>> size_hint_of(const Cursor &c) {
+   return c.size_hint();
+}
+
+
+template<class Cursor>
+inline std::enable_if_t<!has_size_hint<Cursor>::value, boost::optional<std::size_t>> size_hint_of(const Cursor &c) {
+   return remaining_of(c);
+}
+
+
+template<class Cursor>
+inline std::enable_if_t<is_random_access_cursor<Cursor>::value> skip_ahead(Cursor &c, std::size_t n) {
+   c.advance(std::min(n, c.remaining()));
+}
+
+
+template<class Cursor>
+inline std::enable_if_t<!is_random_access_cursor<Cursor>::value> skip_ahead(Cursor &c, std::size_t n) {
+   for (; n > 0 && !c.done(); --n) {
+      c.advance();
+   }
+}
+
+
+template<class Cursor>
+class cursor_source final : public sequence_source<typename Cursor::value_type> {
+public:
+   typedef typename Cursor::value_type value_type;
+
+   explicit inline cursor_source(Cursor &&c) :
+      cursor(std::move(c))
+   {
+   }
+
+   const value_type * get() const override {
+      return cursor.done() ? nullptr : std::addressof(cursor.current());
+   }
+
+   const value_type * next() override {
+      cursor.advance();
+      return get();
+   }
+
+   boost::optional<std::size_t> remaining() const override {
+      return remaining_of(cursor);
+   }
+
+   boost::optional<std::size_t> size_hint() const override {
+      return size_hint_of(cursor);
+   }
+
+   const value_type * skip(std::size_t n) override {
+      skip_ahead(cursor, n);
+      return get();
+   }
+
+   Cursor cursor;
+};
+
+
+// Iterator over a cursor that is visible to the compiler, allowing a chain of
+// fused stages to be inlined into the consuming loop.
+template<class Cursor>
+class cursor_iterator : public std::iterator<std::input_iterator_tag, typename Cursor::value_type, std::ptrdiff_t,
+                                             const typename Cursor::value_type *, const typename Cursor::value_type &> {
+public:
+   typedef typename Cursor::value_type value_type;
+
+   cursor_iterator() = default;
+
+   explicit inline cursor_iterator(Cursor *c) :
+      cursor{c}
+   {
+   }
+
+   inline const value_type & operator*() const {
+      return cursor->current();
+   }
+
+   inline const value_type * operator->() const {
+      return std::addressof(cursor->current());
+   }
+
+   inline cursor_iterator<Cursor> & operator++() {
+      cursor->advance();
       return *this;
    }
 
-   inline sequence_iterator<T> operator++(int) {
-      return sequence_iterator(iter++);
+   inline bool operator==(const cursor_iterator<Cursor> &rhs) const {
+      return at_end() ? rhs.at_end() : (cursor == rhs.cursor && !rhs.at_end());
    }
 
-   inline bool operator==(const sequence_iterator &rhs) const {
-      return const_cast<sequence_iterator &>(*this).iter == const_cast<sequence_iterator &>(rhs).iter;
+   inline bool operator!=(const cursor_iterator<Cursor> &rhs) const {
+      return !(*this == rhs);
    }
 
-   inline bool operator!=(const sequence_iterator &rhs) const {
-      return const_cast<sequence_iterator &>(*this).iter != const_cast<sequence_iterator &>(rhs).iter;
+private:
+   inline bool at_end() const {
+      return cursor == nullptr || cursor->done();
+   }
+
+   Cursor *cursor = nullptr;
+};
+
+}
+
+
+template<class T>
+class sequence_iterator : public std::iterator<std::input_iterator_tag, T, std::ptrdiff_t, const T *, const T &> {
+   friend class sequence<T>;
+
+public:
+   sequence_iterator() = default;
+
+   inline const T & operator*() const {
+      return *value;
+   }
+
+   inline const T * operator->() const {
+      return value;
+   }
+
+   inline sequence_iterator<T> & operator++() {
+      value = source->next();
+      return *this;
+   }
+
+   inline bool operator==(const sequence_iterator<T> &rhs) const {
+      return value == rhs.value;
+   }
+
+   inline bool operator!=(const sequence_iterator<T> &rhs) const {
+      return value != rhs.value;
    }
 
 private:
-   inline sequence_iterator(base_iterator i) :
-      iter(std::move(i))
+   inline sequence_iterator(details_::sequence_source<T> *s) :
+      source{s},
+      value{s ? s->get() : nullptr}
    {
    }
 
-   base_iterator iter;
+   details_::sequence_source<T> *source = nullptr;
+   const T *value = nullptr;
 };
-#else
-template<class T>
-using sequence_iterator = typename boost::range_iterator<typename boost::coroutines::asymmetric_coroutine<T>::pull_type>::type;
-#endif
 
 
 template<class Op>
@@ -76,6 +330,11 @@ public:
    inline auto operator()(sequence<S> &&s) {
       return op(std::move(s));
    }
+
+   template<class Cursor>
+   inline auto operator()(fused_sequence<Cursor> &&s) {
+      return op(std::move(s));
+   }
 };
 
 
@@ -85,6 +344,12 @@ inline sequence_operation<F> sequence_manipulator(F &&f) {
 }
 
 
+// Tag declaring that the inputs of an operator are already ordered, letting
+// it pick a streaming algorithm (e.g. join(sorted_inputs, ...)).
+struct sorted_inputs_t {};
+constexpr sorted_inputs_t sorted_inputs{};
+
+
 namespace details_ {
 
 template<class T>
@@ -120,7 +385,7 @@ struct sink_type_helper<false, T> {
 template<class T>
 class sequence {
    template<class U> friend class sequence;
-   typedef typename boost::coroutines::asymmetric_coroutine<T>::pull_type coro_t;
+   typedef details_::sequence_source<T> source_type;
 
 public:
    typedef T value_type;
@@ -128,23 +393,31 @@ public:
    typedef size_t size_type;
    typedef typename boost::coroutines::asymmetric_coroutine<T>::push_type sink_type;
 
+   template<class Fun, class Alloc>
+   explicit inline sequence(std::allocator_arg_t, const Alloc &alloc, const stack_attributes &attrs, Fun &&f) :
+      source{std::allocate_shared<details_::coroutine_source<T>>(alloc, attrs, std::move(f))}
+   {
+   }
+
    template<class Fun, class Alloc>
    explicit inline sequence(std::allocator_arg_t, const Alloc &alloc, Fun &&f) :
-      coro{std::allocate_shared<coro_t>(alloc, std::move(f))}
+      sequence{std::allocator_arg, alloc, default_stack(), std::move(f)}
    {
    }
 
    template<class Fun>
-   explicit inline sequence(Fun &&f) :
-      sequence{std::allocator_arg, std::allocator<void>{}, std::move(f)}
+   explicit inline sequence(const stack_attributes &attrs, Fun &&f) :
+      sequence{std::allocator_arg, std::allocator<void>{}, attrs, std::move(f)}
    {
    }
 
-   sequence() :
-      sequence{[](sink_type &) {}}
+   template<class Fun, class=std::enable_if_t<!std::is_base_of<sequence, std::decay_t<Fun>>::value>>
+   explicit inline sequence(Fun &&f) :
+      sequence{std::allocator_arg, std::allocator<void>{}, default_stack(), std::move(f)}
    {
    }
 
+   sequence() = default;
    sequence(sequence &&) = default;
    sequence(const sequence &) = delete;
    ~sequence() = default;
@@ -153,22 +426,154 @@ public:
    sequence & operator =(const sequence &) = delete;
 
    inline iterator begin() {
-      return boost::begin(*coro);
+      return iterator{source.get()};
    }
 
    inline iterator end() {
-      return boost::end(*coro);
+      return iterator{};
    }
 
    inline bool empty() const {
-      return !(coro && *coro);
+      return !(source && source->get());
+   }
+
+   // Number of elements left to iterate, if the source knows it without
+   // iterating (e.g. from() over random-access iterators, range()).
+   inline boost::optional<size_type> remaining() const {
+      return source ? source->remaining() : boost::optional<size_type>{0};
+   }
+
+   // Upper bound on remaining(), if known; operators buffering a sequence
+   // (sort, reverse, join, ...) reserve this much up front.
+   inline boost::optional<size_type> size_hint() const {
+      return source ? source->size_hint() : boost::optional<size_type>{0};
+   }
+
+   // Moves past the next n elements (or all of them, if there are fewer); in
+   // constant time when remaining() is known.
+   inline void advance(size_type n) {
+      if (source) {
+         source->skip(n);
+      }
+   }
+
+protected:
+   explicit inline sequence(std::shared_ptr<source_type> s) :
+      source{std::move(s)}
+   {
+   }
+
+   std::shared_ptr<source_type> source;
+};
+
+
+// A sequence whose producer is a statically known cursor.  Operators that can
+// be expressed as cursors (where, select, take, ...) compose these directly, so
+// a pipeline such as `from(v) | where(p) | select(f)` runs without coroutines
+// and is visible to the optimizer as a single loop.  It remains usable
+// anywhere a sequence<value_type> is expected.
+template<class Cursor>
+class fused_sequence : public sequence<typename Cursor::value_type> {
+   typedef sequence<typename Cursor::value_type> base_type;
+   typedef details_::cursor_source<Cursor> source_type;
+
+public:
+   typedef typename Cursor::value_type value_type;
+   typedef Cursor cursor_type;
+   typedef details_::cursor_iterator<Cursor> iterator;
+
+   template<class Alloc>
+   explicit inline fused_sequence(std::allocator_arg_t, const Alloc &alloc, Cursor &&c) :
+      base_type{std::shared_ptr<details_::sequence_source<value_type>>{std::allocate_shared<source_type>(alloc, std::move(c))}}
+   {
+   }
+
+   explicit inline fused_sequence(Cursor &&c) :
+      fused_sequence{std::allocator_arg, std::allocator<void>{}, std::move(c)}
+   {
+   }
+
+   fused_sequence(fused_sequence &&) = default;
+   fused_sequence(const fused_sequence &) = delete;
+
+   fused_sequence & operator =(fused_sequence &&) = default;
+   fused_sequence & operator =(const fused_sequence &) = delete;
+
+   inline iterator begin() {
+      return iterator{&cursor()};
+   }
+
+   inline iterator end() {
+      return iterator{};
+   }
+
+   inline Cursor & cursor() {
+      return static_cast<source_type &>(*this->source).cursor;
+   }
+
+   inline const Cursor & cursor() const {
+      return static_cast<const source_type &>(*this->source).cursor;
+   }
+};
+
+
+namespace details_ {
+
+// Cursor over an already type-erased sequence, letting fused operators be
+// applied to generator-backed (or otherwise erased) sequences.
+template<class T>
+class sequence_cursor {
+public:
+   typedef T value_type;
+
+   explicit inline sequence_cursor(sequence<T> &&s) :
+      seq{std::move(s)},
+      iter{seq.begin()}
+   {
+   }
+
+   inline bool done() const {
+      return iter == sequence_iterator<T>{};
+   }
+
+   inline const T & current() const {
+      return *iter;
+   }
+
+   inline void advance() {
+      ++iter;
+   }
+
+   inline boost::optional<std::size_t> size_hint() const {
+      return seq.size_hint();
    }
 
 private:
-   std::shared_ptr<coro_t> coro;
+   sequence<T> seq;
+   sequence_iterator<T> iter;
 };
 
 
+template<class Cursor>
+inline Cursor cursor_of(fused_sequence<Cursor> &&s) {
+   return std::move(s.cursor());
+}
+
+
+template<class T>
+inline sequence_cursor<T> cursor_of(sequence<T> &&s) {
+   return sequence_cursor<T>{std::move(s)};
+}
+
+
+template<class Alloc, class Cursor>
+inline fused_sequence<Cursor> fuse(const Alloc &alloc, Cursor &&c) {
+   return fused_sequence<Cursor>{std::allocator_arg, alloc, std::move(c)};
+}
+
+}
+
+
 template<class L, class R>
 inline bool operator==(const sequence<L> &l, const sequence<R> &r) {
    using std::begin;
@@ -211,6 +616,22 @@ inline auto operator|(sequence<S> &&s, sequence_operation<Op> sop) {
 }
 
 
+template<class Cursor, class Op>
+inline auto operator|(fused_sequence<Cursor> &s, sequence_operation<Op> sop) {
+   using std::move;
+
+   return sop(move(s));
+}
+
+
+template<class Cursor, class Op>
+inline auto operator|(fused_sequence<Cursor> &&s, sequence_operation<Op> sop) {
+   using std::move;
+
+   return sop(move(s));
+}
+
+
 template<class Sink>
 class sequence_sink_iterator : public std::iterator<std::output_iterator_tag, void, void, void, void> {
 public:
@@ -264,11 +685,15 @@ inline sequence_sink_iterator<Sink> sink_iterator(Sink &sink) {
 
 
 #include "details/aggregate.h"
+#include "details/cache.h"
 #include "details/container.h"
 #include "details/element_access.h"
+#include "details/file.h"
+#include "details/grouping.h"
 #include "details/logical.h"
 #include "details/ordering.h"
 #include "details/partitioning.h"
+#include "details/prefetch.h"
 #include "details/projection.h"
 #include "details/restriction.h"
 #include "details/set_operations.h"
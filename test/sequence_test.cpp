@@ -1,6 +1,9 @@
+#include <chrono>
 #include <iostream>
 #include <random>
+#include <set>
 #include "../include/sequence.h"
+#include <boost/algorithm/string.hpp>
 #include <gtest/gtest.h>
 
 
@@ -337,6 +340,23 @@ TEST(element_at, returns_the_element_at_the_given_index) {
 }
 
 
+TEST(element_at, seeks_random_access_sources_in_constant_time) {
+   // Given
+   const long n = 1L << 40;
+   auto target = range(0L, n);
+
+   // When
+   long actual = range(0L, n) | element_at(n - 5);
+   long last_value = range(0L, n) | last();
+   std::size_t size = std::move(target) | skip(10) | count();
+
+   // Then
+   ASSERT_EQ(n - 5, actual);
+   ASSERT_EQ(n - 1, last_value);
+   ASSERT_EQ(static_cast<std::size_t>(n - 10), size);
+}
+
+
 TEST(element_at, throws_range_error_when_there_is_no_element_at_the_index) {
    // Given
    auto target = from({ 3, 4, 8 });
@@ -498,6 +518,212 @@ TEST(sort, returns_sorted_sequence_using_provided_comparator) {
 }
 
 
+TEST(sort, parallel_sort_is_stable) {
+   // Given
+   std::vector<std::pair<int, int>> input;
+   for (int i = 0; i < 10000; ++i) {
+      input.emplace_back(random_int(0, 50), i);
+   }
+   auto expected = input;
+   std::stable_sort(expected.begin(), expected.end(), [](auto &l, auto &r) { return l.first < r.first; });
+
+   // When
+   auto actual = from(input) | sort(par(3, 16), 0, [](auto &l, auto &r) { return l.first < r.first; });
+
+   // Then
+   std::vector<std::pair<int, int>> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(sort, radix_sorts_signed_integers_in_either_direction) {
+   // Given
+   std::vector<int> input;
+   for (int i = 0; i < 5000; ++i) {
+      input.push_back(random_int(-100000, 100000));
+   }
+   auto ascending = input;
+   auto descending = input;
+   std::sort(ascending.begin(), ascending.end());
+   std::sort(descending.begin(), descending.end(), std::greater<void>{});
+
+   // When
+   auto up = from(input) | sort();
+   auto down = from(input) | sort(0, std::greater<void>{});
+
+   // Then
+   ASSERT_EQ(ascending, (std::vector<int>{up.begin(), up.end()}));
+   ASSERT_EQ(descending, (std::vector<int>{down.begin(), down.end()}));
+}
+
+
+TEST(sort, radix_sorts_floating_point_values) {
+   // Given
+   std::vector<double> input{ -0.0, 0.0 };
+   for (int i = 0; i < 1000; ++i) {
+      input.push_back(random_int(-1000, 1000) / 8.0);
+   }
+   auto expected = input;
+   std::stable_sort(expected.begin(), expected.end());
+
+   // When
+   auto actual = from(input) | sort();
+
+   // Then
+   std::vector<double> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+   ASSERT_TRUE(std::signbit(*std::find(result.begin(), result.end(), 0.0)));
+}
+
+
+TEST(sort_by, stable_sorts_by_selected_key) {
+   // Given
+   std::vector<std::pair<long, int>> input;
+   for (int i = 0; i < 3000; ++i) {
+      input.emplace_back(random_int(-20, 20), i);
+   }
+   auto expected = input;
+   std::stable_sort(expected.begin(), expected.end(), [](auto &l, auto &r) { return l.first > r.first; });
+
+   // When
+   auto actual = from(input) | sort_by([](auto &p) { return p.first; }, std::greater<void>{});
+
+   // Then
+   std::vector<std::pair<long, int>> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(sort, followed_by_take_selects_first_elements_stably) {
+   // Given
+   std::vector<std::pair<int, int>> input;
+   for (int i = 0; i < 2000; ++i) {
+      input.emplace_back(random_int(0, 20), i);
+   }
+   auto expected = input;
+   std::stable_sort(expected.begin(), expected.end(), [](auto &l, auto &r) { return l.first < r.first; });
+   expected.resize(150);
+
+   // When
+   auto actual = from(input) | sort(0, [](auto &l, auto &r) { return l.first < r.first; }) | take(150);
+
+   // Then
+   std::vector<std::pair<int, int>> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(sort, spills_runs_to_disk_beyond_memory_budget) {
+   // Given
+   struct row { int key; int position; };
+   std::vector<row> input;
+   for (int i = 0; i < 10000; ++i) {
+      input.push_back(row{random_int(0, 100), i});
+   }
+   auto by_key = [](const row &l, const row &r) { return l.key < r.key; };
+   auto expected = input;
+   std::stable_sort(expected.begin(), expected.end(), by_key);
+
+   // When
+   auto actual = from(input) | sort(memory_budget(1000 * sizeof(row)), by_key);
+
+   // Then
+   std::vector<int> expected_positions;
+   std::vector<int> positions;
+   for (const row &r : expected) {
+      expected_positions.push_back(r.position);
+   }
+   for (const row &r : actual) {
+      positions.push_back(r.position);
+   }
+   ASSERT_EQ(expected_positions, positions);
+}
+
+
+TEST(sort, merges_runs_in_passes_bounded_by_fan_in) {
+   // Given
+   struct row { int key; int position; };
+   std::vector<row> input;
+   for (int i = 0; i < 5000; ++i) {
+      input.push_back(row{random_int(0, 50), i});
+   }
+   auto by_key = [](const row &l, const row &r) { return l.key < r.key; };
+   auto expected = input;
+   std::stable_sort(expected.begin(), expected.end(), by_key);
+
+   // When
+   auto actual = from(input) | sort(memory_budget(40 * sizeof(row), 3), by_key);
+
+   // Then
+   std::vector<int> expected_positions;
+   std::vector<int> positions;
+   for (const row &r : expected) {
+      expected_positions.push_back(r.position);
+   }
+   for (const row &r : actual) {
+      positions.push_back(r.position);
+   }
+   ASSERT_EQ(expected_positions, positions);
+}
+
+
+TEST(sort, spills_with_provided_serializer) {
+   // Given
+   struct string_serializer {
+      void write(std::FILE *file, const std::string &s) const {
+         std::size_t size = s.size();
+         std::fwrite(&size, sizeof size, 1, file);
+         std::fwrite(s.data(), 1, size, file);
+      }
+
+      bool read(std::FILE *file, std::string &s) const {
+         std::size_t size;
+         if (std::fread(&size, sizeof size, 1, file) != 1) {
+            return false;
+         }
+         s.resize(size);
+         return std::fread(&s[0], 1, size, file) == size;
+      }
+   };
+   std::vector<std::string> input{ "pear", "fig", "apple", "kiwi", "banana", "cherry", "date" };
+   auto expected = input;
+   std::sort(expected.begin(), expected.end());
+
+   // When
+   auto actual = from(input) | sort(memory_budget(2 * sizeof(std::string)), std::less<void>{}, string_serializer{});
+
+   // Then
+   std::vector<std::string> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(top_k, returns_largest_elements_largest_first) {
+   // Given
+   auto target = from({ 5, 1, 9, 3, 7, 9, 2 });
+   std::vector<int> expected = { 9, 9, 7 };
+
+   // When
+   auto actual = target | top_k(3);
+
+   // Then
+   ASSERT_EQ(expected, (std::vector<int>{actual.begin(), actual.end()}));
+}
+
+
+TEST(bottom_k, returns_smallest_elements_smallest_first) {
+   // Given
+   auto target = from({ 5, 1, 9, 3, 7, 9, 2 });
+   std::vector<int> expected = { 1, 2 };
+
+   // When
+   auto actual = target | bottom_k(2);
+
+   // Then
+   ASSERT_EQ(expected, (std::vector<int>{actual.begin(), actual.end()}));
+}
+
+
 TEST(reverse, returns_sequence_in_reverse_order) {
    // Given
    auto target = from({ 2, 3, 1, 4 });
@@ -739,6 +965,98 @@ TEST(minmax, throws_range_error_on_empty_sequence) {
 }
 
 
+TEST(minmax, vectorized_over_contiguous_storage_matches_scalar_loop) {
+   // Given
+   std::vector<std::int16_t> input;
+   for (int i = 0; i < 1037; ++i) {
+      input.push_back(static_cast<std::int16_t>(random_int(-30000, 30000)));
+   }
+   auto expected = std::minmax_element(input.begin(), input.end());
+   std::int16_t last = input.back();
+   std::int16_t absent = 30001;
+
+   // When
+   auto actual = from(input) | minmax();
+   std::int16_t total = from(input) | sum(std::int16_t{0});
+   bool has_last = from(input) | contains(last);
+   bool has_absent = from(input) | contains(absent);
+
+   // Then
+   ASSERT_EQ(*expected.first, actual.first);
+   ASSERT_EQ(*expected.second, actual.second);
+   ASSERT_EQ(std::accumulate(input.begin(), input.end(), std::int16_t{0}, [](std::int16_t l, std::int16_t r) { return static_cast<std::int16_t>(l + r); }), total);
+   ASSERT_TRUE(has_last);
+   ASSERT_FALSE(has_absent);
+}
+
+
+TEST(contains, searches_characters_of_strings_and_non_character_vectors) {
+   // Given
+   struct point {
+      int x;
+      int y;
+      bool operator ==(const point &other) const { return x == other.x && y == other.y; }
+   };
+   std::string text(1000, 'a');
+   text[998] = 'z';
+   std::vector<point> points = { {1, 2}, {3, 4} };
+
+   // When
+   bool has_z = from(text) | contains('z');
+   bool has_y = from(text) | contains('y');
+   bool has_point = from(points) | contains(point{3, 4});
+
+   // Then
+   ASSERT_TRUE(has_z);
+   ASSERT_FALSE(has_y);
+   ASSERT_TRUE(has_point);
+}
+
+
+TEST(aggregate, computes_every_accumulator_in_one_pass) {
+   // Given
+   int calls = 0;
+   auto target = from({4, 8, 1, 5, 2}) | select([&](int x) { ++calls; return x; });
+
+   // When
+   auto result = target | aggregate(counting(), minimum(), maximum(), summing(10), averaging());
+
+   // Then
+   ASSERT_EQ(5U, std::get<0>(result));
+   ASSERT_EQ(1, std::get<1>(result));
+   ASSERT_EQ(8, std::get<2>(result));
+   ASSERT_EQ(30, std::get<3>(result));
+   ASSERT_EQ(4, std::get<4>(result));
+   ASSERT_EQ(5, calls);
+}
+
+
+TEST(aggregate, merges_partial_results_of_parallel_slices) {
+   // Given
+   std::vector<long> values(100000);
+   std::iota(values.begin(), values.end(), -50000L);
+   std::swap(values[10], values[70000]);
+
+   // When
+   auto result = from(values) | aggregate(par(4, 1), counting(), minimum(), maximum(std::less<long>{}), summing(1L));
+
+   // Then
+   ASSERT_EQ(100000U, std::get<0>(result));
+   ASSERT_EQ(-50000L, std::get<1>(result));
+   ASSERT_EQ(49999L, std::get<2>(result));
+   ASSERT_EQ(-49999L, std::get<3>(result));
+}
+
+
+TEST(aggregate, throws_range_error_for_extremes_of_empty_sequence) {
+   // Given
+   std::vector<int> values;
+
+   // When, Then
+   ASSERT_THROW(from(values) | aggregate(counting(), maximum()), std::range_error);
+}
+
+
 TEST(sum, provides_total_of_all_elements) {
    // Given
    std::vector<std::string> svec = { "Andrew", " ", "Ford" };
@@ -793,176 +1111,1077 @@ TEST(sum, uses_provided_initial_value_and_binary_operation) {
 }
 
 
-TEST(inner_product, calculates_correctly) {
+TEST(sum, splits_random_access_sources_across_threads) {
    // Given
-   auto dtarget = from({1.0, 2.0, 3.0});
+   std::vector<long> input;
+   for (int i = 0; i < 10000; ++i) {
+      input.push_back(random_int(-1000, 1000));
+   }
+   long expected = std::accumulate(input.begin(), input.end(), 7L);
 
    // When
-   auto actual = dtarget | inner_product<double>(from({3, 2, 1}), 0.0);
+   long actual = from(input) | sum(7L, std::plus<void>{}, par(4, 1));
+   long over_range = range(0L, 10000L) | sum(0L, std::plus<void>{}, par(4, 1));
 
    // Then
-   ASSERT_DOUBLE_EQ(10.0, actual);
+   ASSERT_EQ(expected, actual);
+   ASSERT_EQ(49995000L, over_range);
 }
 
 
-TEST(select, projects_into_new_type) {
+TEST(sum, runs_sequentially_when_elements_do_not_convert_to_total) {
    // Given
-   std::vector<A> avec = { { "blammo" }, { "booyah" }, { "huzah" } };
-   auto target = from(avec);
-   std::vector<std::string> expected = { "blammo", "booyah", "huzah" };
+   std::vector<char> input;
+   for (int i = 0; i < 1000; ++i) {
+      input.push_back(static_cast<char>('a' + i % 26));
+   }
+   auto append = [](std::string l, const auto &r) { return l + r; };
+   std::string expected = std::accumulate(input.begin(), input.end(), std::string{">"}, append);
 
    // When
-   // Note: Explicitly setting the actual type rather than using auto to ensure
-   //       that the resulting type is what we want (we'll get compiler errors
-   //       if it isn't).
-   sequence<std::string> actual = target | select([](const A &a) { return a.a; });
+   std::string actual = from(input) | sum(std::string{">"}, append, par(4, 1));
 
    // Then
-   ASSERT_TRUE(std::equal(std::begin(expected), std::end(expected), actual.begin()));
+   ASSERT_EQ(expected, actual);
 }
 
 
-TEST(select_many, extracts_single_value_to_many) {
+TEST(sum, seeds_later_slices_with_their_first_element) {
    // Given
-   std::string expected = "hello world";
-   std::vector<std::string> strings = { "hello", " ", "world" };
-   auto target = from(strings);
+   std::vector<long> input(40, 1L);
+   input[3] = 2L;
+   input[25] = 3L;
+   input[39] = 5L;
 
    // When
-   auto actual = target | select_many([](std::string s) { return from(s); });
+   long product = from(input) | sum(1L, std::multiplies<void>{}, par(4, 1));
+   long offset_product = from(input) | sum(7L, std::multiplies<void>{}, par(4, 1));
 
    // Then
-   ASSERT_TRUE(std::equal(std::begin(expected), std::end(expected), actual.begin()));
+   ASSERT_EQ(30L, product);
+   ASSERT_EQ(210L, offset_product);
 }
 
 
-TEST(where, filters_out_uninteresting_values) {
+TEST(minmax, take_a_policy_alone) {
    // Given
-   const int start = 0;
-   const int finish = 10;
-   RecordProperty("start", start);
-   RecordProperty("finish", finish);
-   int expected = start;
+   std::vector<int> input;
+   for (int i = 0; i < 5000; ++i) {
+      input.push_back(random_int(-100000, 100000));
+   }
+   auto expected = std::minmax_element(input.begin(), input.end());
 
    // When
-   auto target = range(start, finish)
-                     | where([](int x) { return x % 2 == 0; });
+   int smallest = from(input) | min(par(4, 1));
+   int largest = from(input) | max(par(4, 1));
+   auto both = from(input) | minmax(par(4, 1));
 
    // Then
-   for (int actual : target) {
-      ASSERT_EQ(expected, actual);
-      expected += 2;
-   }
+   ASSERT_EQ(*expected.first, smallest);
+   ASSERT_EQ(*expected.second, largest);
+   ASSERT_EQ(*expected.first, both.first);
+   ASSERT_EQ(*expected.second, both.second);
 }
 
 
-TEST(concat, appends_to_sequence) {
+TEST(aggregate, multiplies_in_parallel_without_an_identity) {
    // Given
-   auto arg = range(3, 6);
-   auto target = range(0, 3);
-   std::vector<int> ivec = { 0, 1, 2, 3, 4, 5 };
+   std::vector<long> input(40, 1L);
+   input[3] = 2L;
+   input[39] = 5L;
 
    // When
-   auto actual = target | concat(std::move(arg));
+   auto actual = from(input) | aggregate(par(4, 1), summing(1L, std::multiplies<void>{}), counting());
 
    // Then
-   ASSERT_TRUE(std::equal(ivec.begin(), ivec.end(), actual.begin()));
+   ASSERT_EQ(10L, std::get<0>(actual));
+   ASSERT_EQ(40U, std::get<1>(actual));
 }
 
 
-TEST(take, returns_first_n_elements) {
-  // Given
-  std::vector<int> ivec = { 1, 2, 3 };
-  auto target = from({1, 2, 3, 4, 5, 6});
+class counting_executor : public executor {
+public:
+   void execute(std::function<void()> task) override {
+      ++submitted;
+      std::thread{std::move(task)}.detach();
+   }
 
-  // When
-  auto actual = target | take(3);
+   std::size_t concurrency() const override {
+      return 3;
+   }
 
-  // Then
-  ASSERT_TRUE(std::equal(ivec.begin(), ivec.end(), actual.begin()));
-}
+   std::atomic<int> submitted{0};
+};
 
-TEST(take, returns_all_elements_when_n_is_greater_than_number_of_elements) {
-  // Given
-  size_t expected = 6;
-  auto target = from({1, 2, 3, 4, 5, 6}) | take(20);
 
-  // When
-  std::size_t actual = target | count();
+TEST(sort, sorts_spilled_runs_on_the_given_policy) {
+   // Given
+   counting_executor threads;
+   std::vector<int> input;
+   for (int i = 0; i < 400; ++i) {
+      input.push_back(random_int(0, 100000));
+   }
+   auto descending = [](int l, int r) { return r < l; };
+   auto expected = input;
+   std::sort(expected.begin(), expected.end(), descending);
 
-  // Then
-  ASSERT_EQ(expected, actual);
+   // When
+   auto actual = from(input) | sort(par(2, 1).on(threads), memory_budget(100 * sizeof(int)), descending);
+   std::vector<int> result{actual.begin(), actual.end()};
+
+   // Then
+   ASSERT_LT(0, threads.submitted.load());
+   ASSERT_EQ(expected, result);
 }
 
 
-TEST(take, is_empty_after_exhausting_all_elements) {
-  // Given
-  auto target = from({1, 2, 3, 4, 5, 6}) | take(0);
+TEST(work_stealing_pool, runs_nested_parallel_operators_on_its_workers) {
+   // Given
+   work_stealing_pool pool{2};
+   std::mutex mutex;
+   std::set<std::thread::id> threads;
+   std::vector<long> input(100000, 1L);
 
-  // When
-  bool actual = target.empty();
+   // When
+   auto outer = range(0, 8) | parallel_select([&](int) {
+         {
+            std::lock_guard<std::mutex> lock{mutex};
+            threads.insert(std::this_thread::get_id());
+         }
+         return from(input) | sum(0L, std::plus<void>{}, par(3, 1).on(pool));
+      }, par(0, 1).on(pool), 8);
+   std::vector<long> totals{outer.begin(), outer.end()};
 
-  // Then
-  ASSERT_TRUE(actual);
+   // Then
+   ASSERT_EQ(std::vector<long>(8, 100000L), totals);
+   ASSERT_EQ(3U, pool.concurrency());
+   ASSERT_LE(threads.size(), 3U);
 }
 
 
-TEST(take_while, stops_taking_elements_after_predicate_fails) {
-  // Given
-  std::vector<int> ivec = { 1, 2, 3 };
-  auto target = from({1, 2, 3, 4, 5, 6});
+TEST(executor, policy_submits_to_supplied_executor) {
+   // Given
+   counting_executor e;
 
-  // When
-  auto actual = target | take_while([](int x) { return (x % 7) < 4; });
+   // When
+   long total = range(0L, 10000L) | sum(0L, std::plus<void>{}, par(0, 1).on(e));
 
-  // Then
-  ASSERT_TRUE(std::equal(ivec.begin(), ivec.end(), actual.begin()));
+   // Then
+   ASSERT_EQ(49995000L, total);
+   ASSERT_EQ(2, e.submitted);
 }
 
 
-TEST(skip, skips_first_n_elements) {
+TEST(executor, default_executor_can_be_replaced) {
    // Given
-   std::string s = "foobar";
-   auto target = from(s);
+   auto original = default_executor();
+   auto replacement = std::make_shared<counting_executor>();
 
    // When
-   auto actual = target | skip(3);
+   set_default_executor(replacement);
+   long total = range(0L, 10000L) | sum(0L, std::plus<void>{}, par(0, 1));
+   set_default_executor(original);
 
    // Then
-   ASSERT_TRUE(std::equal(s.begin() + 3, s.end(), actual.begin()));
+   ASSERT_EQ(49995000L, total);
+   ASSERT_EQ(2, replacement->submitted);
+   ASSERT_EQ(original, default_executor());
 }
 
 
-TEST(skip, produces_empty_sequence_when_there_are_not_enough_elements_to_skip) {
+TEST(minmax, combines_partial_results_of_parallel_slices) {
    // Given
-   std::string s = "foobar";
-   auto target = from(s);
+   std::vector<int> input;
+   for (int i = 0; i < 10000; ++i) {
+      input.push_back(random_int(-100000, 100000));
+   }
+   auto expected = std::minmax_element(input.begin(), input.end());
 
    // When
-   auto actual = target | skip(30);
+   auto actual = from(input) | minmax(std::less<void>{}, par(4, 1));
+   int smallest = from(input) | min(std::less<void>{}, par(3, 1));
+   int largest = from(input) | max(std::less<void>{}, par(3, 1));
+   std::size_t n = from(input) | count(par(3, 1));
+   std::size_t positive = from(input) | count([](int i) { return i > 0; }, par(3, 1));
 
    // Then
-   ASSERT_TRUE(actual.empty());
+   ASSERT_EQ(*expected.first, actual.first);
+   ASSERT_EQ(*expected.second, actual.second);
+   ASSERT_EQ(*expected.first, smallest);
+   ASSERT_EQ(*expected.second, largest);
+   ASSERT_EQ(input.size(), n);
+   ASSERT_EQ(static_cast<std::size_t>(std::count_if(input.begin(), input.end(), [](int i) { return i > 0; })), positive);
 }
 
 
-TEST(skip_while, skips_until_predicate_fails) {
+TEST(inner_product, calculates_correctly) {
    // Given
-   std::string s = "foobar";
-   auto target = from(s);
+   auto dtarget = from({1.0, 2.0, 3.0});
 
    // When
-   auto actual = target | skip_while([](char c) { return c != 'b'; });
+   auto actual = dtarget | inner_product<double>(from({3, 2, 1}), 0.0);
 
    // Then
-   ASSERT_TRUE(std::equal(s.begin() + 3, s.end(), actual.begin()));
+   ASSERT_DOUBLE_EQ(10.0, actual);
 }
 
 
-TEST(page, returns_page_size_when_enough_elements_are_available) {
-  // Given
-  size_t expected = 2;
-  auto target = from({1.0, 2.0, 3.0, 4.0, 5.0, 6.0}) | page(0, 2);
+TEST(select, projects_into_new_type) {
+   // Given
+   std::vector<A> avec = { { "blammo" }, { "booyah" }, { "huzah" } };
+   auto target = from(avec);
+   std::vector<std::string> expected = { "blammo", "booyah", "huzah" };
+
+   // When
+   // Note: Explicitly setting the actual type rather than using auto to ensure
+   //       that the resulting type is what we want (we'll get compiler errors
+   //       if it isn't).
+   sequence<std::string> actual = target | select([](const A &a) { return a.a; });
+
+   // Then
+   ASSERT_TRUE(std::equal(std::begin(expected), std::end(expected), actual.begin()));
+}
+
+
+TEST(select_many, extracts_single_value_to_many) {
+   // Given
+   std::string expected = "hello world";
+   std::vector<std::string> strings = { "hello", " ", "world" };
+   auto target = from(strings);
+
+   // When
+   // from() borrows lvalues, so the sequence must own the parameter it
+   // outlives.
+   auto actual = target | select_many([](std::string s) { return from(std::move(s)); });
+
+   // Then
+   ASSERT_TRUE(std::equal(std::begin(expected), std::end(expected), actual.begin()));
+}
+
+
+TEST(where, filters_out_uninteresting_values) {
+   // Given
+   const int start = 0;
+   const int finish = 10;
+   RecordProperty("start", start);
+   RecordProperty("finish", finish);
+   int expected = start;
+
+   // When
+   auto target = range(start, finish)
+                     | where([](int x) { return x % 2 == 0; });
+
+   // Then
+   for (int actual : target) {
+      ASSERT_EQ(expected, actual);
+      expected += 2;
+   }
+}
+
+
+TEST(where, filters_a_generator_backed_sequence) {
+   // Given
+   sequence<int> target{[](auto &yield) {
+         for (int i = 0; i < 10; ++i) {
+            yield(i);
+         }
+      }};
+   std::vector<int> expected = { 1, 3, 5, 7, 9 };
+
+   // When
+   auto actual = std::move(target) | where([](int x) { return x % 2 == 1; });
+
+   // Then
+   ASSERT_TRUE(std::equal(expected.begin(), expected.end(), actual.begin()));
+}
+
+
+TEST(fused_sequence, composes_operators_without_erasing_the_pipeline) {
+   // Given
+   std::vector<int> ivec = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+   // When
+   auto target = from(ivec)
+                     | where([](int x) { return x % 2 == 0; })
+                     | select([](int x) { return x * 10; })
+                     | take(3);
+   int actual = target | sum(0);
+
+   // Then
+   static_assert(std::is_base_of<sequence<int>, decltype(target)>::value, "Fused pipelines must remain sequences.");
+   static_assert(!std::is_same<sequence<int>, decltype(target)>::value, "Pipeline should not have been type-erased.");
+   ASSERT_EQ(120, actual);
+}
+
+
+TEST(fused_sequence, converts_to_sequence_of_value_type) {
+   // Given
+   std::vector<int> expected = { 2, 4, 6 };
+
+   // When
+   sequence<int> actual = range(1, 4) | select([](int x) { return x * 2; });
+
+   // Then
+   ASSERT_TRUE(std::equal(expected.begin(), expected.end(), actual.begin()));
+}
+
+
+TEST(group_by, groups_elements_by_key_in_order_of_first_appearance) {
+   // Given
+   auto target = from({ 1, 2, 3, 4, 5, 6, 7 });
+
+   // When
+   auto actual = target | group_by([](int x) { return x % 3; });
+
+   // Then
+   std::vector<std::pair<int, std::vector<int>>> result{actual.begin(), actual.end()};
+   std::vector<std::pair<int, std::vector<int>>> expected = { {1, {1, 4, 7}}, {2, {2, 5}}, {0, {3, 6}} };
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(aggregate_by, folds_each_group_without_storing_members) {
+   // Given
+   auto target = from({ "apple", "avocado", "banana", "blueberry", "cherry" }) | select([](const char *s) { return std::string{s}; });
+
+   // When
+   auto actual = std::move(target) | aggregate_by([](const std::string &s) { return s[0]; }, std::size_t{0},
+                                                  [](std::size_t n, const std::string &) { return n + 1; });
+
+   // Then
+   std::vector<std::pair<char, std::size_t>> result{actual.begin(), actual.end()};
+   std::vector<std::pair<char, std::size_t>> expected = { {'a', 2}, {'b', 2}, {'c', 1} };
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(cache, replays_upstream_without_recomputing_it) {
+   // Given
+   int calls = 0;
+   auto target = range(0, 10) | select([&](int x) { ++calls; return x * 2; }) | cache(3);
+
+   // When
+   std::size_t n = target | count();
+   int total = target | sum(0);
+   auto first = target.replay();
+   auto second = target.replay();
+   auto i = first.begin();
+   auto j = second.begin();
+   ++i;
+   ++i;
+   int third = *i;
+   ++j;
+   int second_element = *j;
+
+   // Then
+   ASSERT_EQ(10U, n);
+   ASSERT_EQ(90, total);
+   ASSERT_EQ(4, third);
+   ASSERT_EQ(2, second_element);
+   ASSERT_EQ(10, calls);
+}
+
+
+TEST(cache, throws_when_exceeding_memory_cap) {
+   // Given
+   auto target = range(0, 100) | cache(10, 20 * sizeof(int));
+
+   // When
+   auto replay = target.replay();
+
+   // Then
+   ASSERT_THROW(replay | count(), std::length_error);
+}
+
+
+TEST(cache, keeps_recorded_chunks_intact_past_memory_cap) {
+   // Given
+   auto target = range(0, 100) | cache(10, 20 * sizeof(int));
+   auto first_twenty = [&] {
+         auto replay = target.replay() | take(20);
+         return std::vector<int>{replay.begin(), replay.end()};
+      };
+   std::vector<int> expected(20);
+   std::iota(expected.begin(), expected.end(), 0);
+
+   // When
+   auto before = first_twenty();
+   auto over_cap = [&] { return target | count(); };
+
+   // Then
+   ASSERT_EQ(expected, before);
+   ASSERT_THROW(over_cap(), std::length_error);
+   ASSERT_EQ(expected, first_twenty());
+   ASSERT_THROW(over_cap(), std::length_error);
+}
+
+
+TEST(cache, rethrows_upstream_exception_to_every_replay) {
+   // Given
+   auto target = range(0, 10) | select([](int x) {
+         if (x == 9) {
+            throw std::runtime_error("upstream failure");
+         }
+         return x;
+      }) | cache(4);
+   auto replay_all = [&] {
+         std::vector<int> elements;
+         for (int x : target.replay()) {
+            elements.push_back(x);
+         }
+         return elements;
+      };
+
+   // When
+   auto first = [&] { return replay_all(); };
+
+   // Then
+   ASSERT_THROW(first(), std::runtime_error);
+   ASSERT_THROW(replay_all(), std::runtime_error);
+}
+
+
+TEST(tee, yields_all_elements_to_every_consumer) {
+   // Given
+   int calls = 0;
+   auto consumers = range(0, 5) | select([&](int x) { ++calls; return x; }) | tee(2);
+
+   // When
+   auto i = consumers[0].begin();
+   auto j = consumers[1].begin();
+   std::vector<int> left;
+   std::vector<int> right;
+   for (; i != consumers[0].end(); ++i, ++j) {
+      left.push_back(*i);
+      right.push_back(*j);
+   }
+
+   // Then
+   std::vector<int> expected = {0, 1, 2, 3, 4};
+   ASSERT_EQ(expected, left);
+   ASSERT_EQ(expected, right);
+   ASSERT_TRUE(j == consumers[1].end());
+   ASSERT_EQ(5, calls);
+}
+
+
+TEST(broadcast, computes_several_aggregates_in_one_pass) {
+   // Given
+   int calls = 0;
+   auto target = range(1, 2001) | select([&](int x) { ++calls; return x; });
+
+   // When
+   auto result = target | broadcast(count(), max(), sum(0), first());
+
+   // Then
+   ASSERT_EQ(2000U, std::get<0>(result));
+   ASSERT_EQ(2000, std::get<1>(result));
+   ASSERT_EQ(2001000, std::get<2>(result));
+   ASSERT_EQ(1, std::get<3>(result));
+   ASSERT_EQ(2000, calls);
+}
+
+
+TEST(prefetch, yields_upstream_elements_in_order) {
+   // Given
+   auto target = range(0, 10000) | select([](int x) { return x * 3; }) | prefetch(64, 8);
+
+   // When
+   std::vector<int> actual{target.begin(), target.end()};
+
+   // Then
+   ASSERT_EQ(10000U, actual.size());
+   for (int i = 0; i < 10000; ++i) {
+      ASSERT_EQ(i * 3, actual[i]);
+   }
+}
+
+
+TEST(prefetch, rethrows_upstream_exception_after_preceding_elements) {
+   // Given
+   auto target = range(0, 100) | select([](int x) {
+         if (x == 50) {
+            throw std::runtime_error("upstream failure");
+         }
+         return x;
+      }) | prefetch(16);
+
+   // When
+   int total = 0;
+   auto run = [&] {
+         for (int x : target) {
+            total += x;
+         }
+      };
+
+   // Then
+   ASSERT_THROW(run(), std::runtime_error);
+   ASSERT_EQ(1225, total);
+}
+
+
+TEST(prefetch, stops_worker_when_abandoned_early) {
+   // Given
+   std::vector<int> expected = {0, 1, 2};
+
+   // When
+   auto target = range(0, std::numeric_limits<int>::max()) | prefetch(32) | take(3);
+   std::vector<int> actual{target.begin(), target.end()};
+
+   // Then
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(prefetch, stops_worker_filtering_out_everything_when_abandoned) {
+   // Given
+   auto started = std::chrono::steady_clock::now();
+
+   // When
+   {
+      auto target = range(0L, std::numeric_limits<long>::max()) | stage(where([](long) { return false; }), 32) | prefetch(32);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+   }
+
+   // Then
+   ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+}
+
+
+TEST(prefetch, hands_over_partial_batch_while_upstream_blocks) {
+   // Given
+   std::mutex mutex;
+   std::condition_variable changed;
+   bool taken = false;
+   bool waited_for_consumer = false;
+   sequence<int> upstream{[&](auto &yield) {
+         yield(0);
+         {
+            std::unique_lock<std::mutex> lock{mutex};
+            waited_for_consumer = changed.wait_for(lock, std::chrono::seconds(5), [&] { return taken; });
+         }
+         yield(1);
+      }};
+   auto target = std::move(upstream) | prefetch(1024, 512);
+
+   // When
+   std::vector<int> actual;
+   for (int x : target) {
+      actual.push_back(x);
+      std::lock_guard<std::mutex> lock{mutex};
+      taken = true;
+      changed.notify_all();
+   }
+
+   // Then
+   ASSERT_EQ((std::vector<int>{0, 1}), actual);
+   ASSERT_TRUE(waited_for_consumer);
+}
+
+
+TEST(prefetch, hands_over_elements_when_either_side_sleeps) {
+   // Given
+   auto pause = [](int x) {
+         if (x % 50 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+         }
+         return x;
+      };
+   auto target = range(0, 1000) | select(pause) | prefetch(8, 4);
+
+   // When
+   std::vector<int> actual;
+   for (int x : target) {
+      actual.push_back(pause(x + 25));
+   }
+
+   // Then
+   std::vector<int> expected(1000);
+   std::iota(expected.begin(), expected.end(), 25);
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(pipeline, runs_each_stage_on_its_own_thread) {
+   // Given
+   std::mutex mutex;
+   std::set<std::thread::id> where_threads;
+   std::set<std::thread::id> select_threads;
+   auto target = range(0, 1000) | pipeline(
+         where([&](int x) {
+               std::lock_guard<std::mutex> lock{mutex};
+               where_threads.insert(std::this_thread::get_id());
+               return x % 2 == 0;
+            }),
+         select([&](int x) {
+               std::lock_guard<std::mutex> lock{mutex};
+               select_threads.insert(std::this_thread::get_id());
+               return x / 2;
+            }));
+
+   // When
+   std::vector<int> actual{target.begin(), target.end()};
+
+   // Then
+   std::vector<int> expected(500);
+   std::iota(expected.begin(), expected.end(), 0);
+   ASSERT_EQ(expected, actual);
+   ASSERT_EQ(1U, where_threads.size());
+   ASSERT_EQ(1U, select_threads.size());
+   ASSERT_NE(*where_threads.begin(), *select_threads.begin());
+   ASSERT_EQ(0U, where_threads.count(std::this_thread::get_id()) + select_threads.count(std::this_thread::get_id()));
+}
+
+
+TEST(parallel_select, yields_projections_in_upstream_order) {
+   // Given
+   std::vector<int> expected(10000);
+   std::iota(expected.begin(), expected.end(), 0);
+   std::transform(expected.begin(), expected.end(), expected.begin(), [](int x) { return x * x % 1013; });
+
+   // When
+   auto target = range(0, 10000) | parallel_select([](int x) { return x * x % 1013; }, par(4, 1), 1000);
+   std::vector<int> actual{target.begin(), target.end()};
+
+   // Then
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(parallel_where, yields_matches_in_upstream_order_or_unordered) {
+   // Given
+   auto is_multiple_of_7 = [](int x) { return x % 7 == 0; };
+   std::vector<int> expected;
+   for (int i = 0; i < 5000; ++i) {
+      if (is_multiple_of_7(i)) {
+         expected.push_back(i);
+      }
+   }
+
+   // When
+   auto ordered = range(0, 5000) | parallel_where(is_multiple_of_7, par(3, 1), 256);
+   auto unordered = range(0, 5000) | parallel_where(is_multiple_of_7, par(3, 1), 256, result_order::unordered);
+   std::vector<int> ordered_result{ordered.begin(), ordered.end()};
+   std::vector<int> unordered_result{unordered.begin(), unordered.end()};
+   std::sort(unordered_result.begin(), unordered_result.end());
+
+   // Then
+   ASSERT_EQ(expected, ordered_result);
+   ASSERT_EQ(expected, unordered_result);
+}
+
+
+TEST(parallel_select, yields_finished_slices_while_later_ones_run_when_unordered) {
+   // Given
+   counting_executor threads;
+   std::mutex mutex;
+   std::condition_variable changed;
+   bool taken = false;
+   bool waited_for_consumer = false;
+   auto target = range(0, 100) | parallel_select([&](int x) {
+         if (x == 50) {
+            // The second slice only finishes once the first one was yielded.
+            std::unique_lock<std::mutex> lock{mutex};
+            waited_for_consumer = changed.wait_for(lock, std::chrono::seconds(5), [&] { return taken; });
+         }
+         return x;
+      }, par(2, 1).on(threads), 100, result_order::unordered);
+
+   // When
+   auto i = target.begin();
+   const int first = *i;
+   {
+      std::lock_guard<std::mutex> lock{mutex};
+      taken = true;
+   }
+   changed.notify_all();
+   std::vector<int> actual{first};
+   actual.insert(actual.end(), ++i, target.end());
+   std::sort(actual.begin(), actual.end());
+
+   // Then
+   std::vector<int> expected(100);
+   std::iota(expected.begin(), expected.end(), 0);
+   ASSERT_EQ(0, first);
+   ASSERT_TRUE(waited_for_consumer);
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(parallel_select, rethrows_slice_exception_when_unordered) {
+   // Given
+   counting_executor threads;
+   auto failing = [](int x) {
+         if (x == 700) {
+            throw std::runtime_error("slice failure");
+         }
+         return x;
+      };
+
+   // When
+   auto run = [&] {
+         auto target = range(0, 1000) | parallel_select(failing, par(4, 1).on(threads), 1000, result_order::unordered);
+         for (int x : target) {
+            (void) x;
+         }
+      };
+
+   // Then
+   ASSERT_THROW(run(), std::runtime_error);
+}
+
+
+TEST(parallel_for_each, visits_every_element_once) {
+   // Given
+   work_stealing_pool pool{3};
+   std::vector<std::atomic<int>> visits(10000);
+   for (auto &v : visits) {
+      v = 0;
+   }
+
+   // When
+   range(0, 10000) | parallel_for_each([&](int x) { ++visits[x]; }, 64, par(0, 1).on(pool));
+
+   // Then
+   for (auto &v : visits) {
+      ASSERT_EQ(1, v.load());
+   }
+}
+
+
+TEST(parallel_for_each, rethrows_exception_from_apply) {
+   // Given
+   auto apply = [](int x) {
+         if (x == 500) {
+            throw std::runtime_error("sink failure");
+         }
+      };
+
+   // When, Then
+   ASSERT_THROW(range(0, 10000) | parallel_for_each(apply, 100), std::runtime_error);
+}
+
+
+TEST(parallel_for_each, waits_for_dispatched_chunks_when_upstream_throws) {
+   // Given
+   work_stealing_pool pool{2};
+   std::atomic<int> visited{0};
+   auto target = range(0, 10000) | select([](int x) {
+         if (x == 3000) {
+            throw std::runtime_error("upstream failure");
+         }
+         return x;
+      });
+
+   // When, Then
+   ASSERT_THROW(target | parallel_for_each([&](int) { ++visited; }, 100, par(0, 1).on(pool)), std::runtime_error);
+   ASSERT_LE(visited.load(), 3000);
+}
+
+
+TEST(from_mapped_file, yields_records_in_place_with_random_access) {
+   // Given
+   struct record { int key; int position; };
+   std::vector<record> rows;
+   for (int i = 0; i < 1000; ++i) {
+      rows.push_back(record{i % 17, i});
+   }
+   char path[] = "/tmp/sequence_test_XXXXXX";
+   int fd = ::mkstemp(path);
+   ASSERT_EQ(static_cast<ssize_t>(rows.size() * sizeof(record)), ::write(fd, rows.data(), rows.size() * sizeof(record)));
+   ::close(fd);
+
+   // When
+   auto target = from_mapped_file<record>(path);
+   auto size = target.remaining();
+   int positions = target | select([](const record &r) { return r.position; }) | sum(0);
+   record seventh = from_mapped_file<record>(path) | element_at(7);
+   ::unlink(path);
+
+   // Then
+   ASSERT_EQ(1000U, *size);
+   ASSERT_EQ(499500, positions);
+   ASSERT_EQ(7, seventh.key);
+   ASSERT_EQ(7, seventh.position);
+}
+
+
+TEST(from_mapped_file, throws_when_file_cannot_be_opened) {
+   // Given, When, Then
+   ASSERT_THROW(from_mapped_file<int>("/nonexistent/sequence_test"), std::runtime_error);
+}
+
+
+TEST(lines, yields_lines_spanning_and_exceeding_blocks) {
+   // Given
+   const std::string text = "first\n\na line longer than one block\nlast without newline";
+   char path[] = "/tmp/sequence_test_XXXXXX";
+   int fd = ::mkstemp(path);
+   ASSERT_EQ(static_cast<ssize_t>(text.size()), ::write(fd, text.data(), text.size()));
+   ::close(fd);
+
+   // When
+   std::vector<std::string> actual;
+   for (boost::string_view line : lines(path, 8)) {
+      actual.push_back(line.to_string());
+   }
+   ::unlink(path);
+
+   // Then
+   std::vector<std::string> expected = {"first", "", "a line longer than one block", "last without newline"};
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(lines, strips_carriage_return_from_crlf_terminators) {
+   // Given
+   const std::string text = "first\r\nsecond\r\n\r\nlast";
+   char path[] = "/tmp/sequence_test_XXXXXX";
+   int fd = ::mkstemp(path);
+   ASSERT_EQ(static_cast<ssize_t>(text.size()), ::write(fd, text.data(), text.size()));
+   ::close(fd);
+
+   // When
+   std::vector<std::string> actual;
+   for (boost::string_view line : lines(path, 4)) {
+      actual.push_back(line.to_string());
+   }
+   ::unlink(path);
+
+   // Then
+   std::vector<std::string> expected = {"first", "second", "", "last"};
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(lines, owning_lines_outlive_the_buffer_when_sorted) {
+   // Given
+   const std::string text = "delta\nalpha\ncharlie\nbravo\n";
+   char path[] = "/tmp/sequence_test_XXXXXX";
+   int fd = ::mkstemp(path);
+   ASSERT_EQ(static_cast<ssize_t>(text.size()), ::write(fd, text.data(), text.size()));
+   ::close(fd);
+
+   // When
+   auto target = lines<std::string>(path, 4) | sort();
+   std::vector<std::string> actual(target.begin(), target.end());
+   ::unlink(path);
+
+   // Then
+   std::vector<std::string> expected = {"alpha", "bravo", "charlie", "delta"};
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(lines, reads_from_descriptor_without_closing_it) {
+   // Given
+   int fds[2];
+   ASSERT_EQ(0, ::pipe(fds));
+   const std::string text = "a\nbb\nccc\n";
+   ASSERT_EQ(static_cast<ssize_t>(text.size()), ::write(fds[1], text.data(), text.size()));
+   ::close(fds[1]);
+
+   // When
+   std::size_t longest = lines(fds[0]) | select([](boost::string_view line) { return line.size(); }) | max();
+   std::size_t rest = lines(fds[0]) | count();
+
+   // Then
+   ASSERT_EQ(3U, longest);
+   ASSERT_EQ(0U, rest);
+   ASSERT_EQ(0, ::close(fds[0]));
+}
+
+
+TEST(concat, appends_to_sequence) {
+   // Given
+   auto arg = range(3, 6);
+   auto target = range(0, 3);
+   std::vector<int> ivec = { 0, 1, 2, 3, 4, 5 };
+
+   // When
+   auto actual = target | concat(std::move(arg));
+
+   // Then
+   ASSERT_TRUE(std::equal(ivec.begin(), ivec.end(), actual.begin()));
+}
+
+
+TEST(concat, sums_sizes_of_both_sequences) {
+   // Given
+   std::vector<int> input{ 1, 2, 3, 4 };
+
+   // When
+   auto actual = from(input) | select([](int x) { return x * 10; }) | concat(range(0, 3)) | skip(1);
+
+   // Then
+   ASSERT_EQ(6U, *actual.remaining());
+   ASSERT_EQ(2, actual | last());
+}
+
+
+TEST(take, returns_first_n_elements) {
+  // Given
+  std::vector<int> ivec = { 1, 2, 3 };
+  auto target = from({1, 2, 3, 4, 5, 6});
+
+  // When
+  auto actual = target | take(3);
+
+  // Then
+  ASSERT_TRUE(std::equal(ivec.begin(), ivec.end(), actual.begin()));
+}
+
+TEST(take, returns_all_elements_when_n_is_greater_than_number_of_elements) {
+  // Given
+  size_t expected = 6;
+  auto target = from({1, 2, 3, 4, 5, 6}) | take(20);
+
+  // When
+  std::size_t actual = target | count();
+
+  // Then
+  ASSERT_EQ(expected, actual);
+}
+
+
+TEST(take, is_empty_after_exhausting_all_elements) {
+  // Given
+  auto target = from({1, 2, 3, 4, 5, 6}) | take(0);
+
+  // When
+  bool actual = target.empty();
+
+  // Then
+  ASSERT_TRUE(actual);
+}
+
+
+TEST(take, does_not_pull_past_the_last_taken_element) {
+  // Given
+  int pulled = 0;
+  sequence<int> target{[&pulled](auto &yield) {
+        for (int i = 0; i < 10; ++i) {
+           ++pulled;
+           yield(i);
+        }
+     }};
+
+  // When
+  std::size_t actual = std::move(target) | take(3) | count();
+
+  // Then
+  ASSERT_EQ(3U, actual);
+  ASSERT_EQ(3, pulled);
+}
+
+
+TEST(take, bounds_size_hint_only_when_upstream_has_one) {
+   // Given
+   auto generator = [](auto &yield) {
+         for (int i = 0; i < 10; ++i) {
+            yield(i);
+         }
+      };
+
+   // When
+   auto over_generator = sequence<int>{generator} | take(4);
+   auto over_range = range(0, 100) | take(4);
+
+   // Then
+   ASSERT_FALSE(over_generator.size_hint());
+   ASSERT_EQ(4U, *over_range.size_hint());
+   ASSERT_EQ(4U, over_generator | count());
+}
+
+
+TEST(take, huge_n_does_not_reserve_for_sort) {
+   // Given
+   sequence<int> target{[](auto &yield) {
+         for (int i = 10; i > 0; --i) {
+            yield(i);
+         }
+      }};
+
+   // When
+   auto sorted = std::move(target) | take(std::numeric_limits<std::size_t>::max()) | sort();
+   std::vector<int> actual{sorted.begin(), sorted.end()};
+
+   // Then
+   std::vector<int> expected = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+   ASSERT_EQ(expected, actual);
+}
+
+
+TEST(take_while, stops_taking_elements_after_predicate_fails) {
+  // Given
+  std::vector<int> ivec = { 1, 2, 3 };
+  auto target = from({1, 2, 3, 4, 5, 6});
+
+  // When
+  auto actual = target | take_while([](int x) { return (x % 7) < 4; });
+
+  // Then
+  ASSERT_TRUE(std::equal(ivec.begin(), ivec.end(), actual.begin()));
+}
+
+
+TEST(skip, skips_first_n_elements) {
+   // Given
+   std::string s = "foobar";
+   auto target = from(s);
+
+   // When
+   auto actual = target | skip(3);
+
+   // Then
+   ASSERT_TRUE(std::equal(s.begin() + 3, s.end(), actual.begin()));
+}
+
+
+TEST(skip, produces_empty_sequence_when_there_are_not_enough_elements_to_skip) {
+   // Given
+   std::string s = "foobar";
+   auto target = from(s);
+
+   // When
+   auto actual = target | skip(30);
+
+   // Then
+   ASSERT_TRUE(actual.empty());
+}
+
+
+TEST(skip, keeps_size_of_erased_random_access_sequence) {
+   // Given
+   std::vector<int> input{ 1, 2, 3, 4, 5, 6 };
+   sequence<int> target = from(input);
+
+   // When
+   auto actual = std::move(target) | skip(4);
+
+   // Then
+   ASSERT_EQ(2U, *actual.remaining());
+   ASSERT_EQ(6, actual | last());
+}
+
+
+TEST(skip_while, skips_until_predicate_fails) {
+   // Given
+   std::string s = "foobar";
+   auto target = from(s);
+
+   // When
+   auto actual = target | skip_while([](char c) { return c != 'b'; });
+
+   // Then
+   ASSERT_TRUE(std::equal(s.begin() + 3, s.end(), actual.begin()));
+}
+
+
+TEST(page, returns_page_size_when_enough_elements_are_available) {
+  // Given
+  size_t expected = 2;
+  auto target = from({1.0, 2.0, 3.0, 4.0, 5.0, 6.0}) | page(0, 2);
 
   // When
   std::size_t actual = target | count();
@@ -1066,6 +2285,61 @@ TEST(symmetric_difference, properly_performs_set_difference) {
 }
 
 
+TEST(distinct, yields_first_occurrence_of_each_element) {
+   // Given
+   auto target = from({ 5, 1, 5, 2, 1, 9, 2, 5 });
+   std::vector<int> expected = { 5, 1, 2, 9 };
+
+   // When
+   auto actual = target | distinct();
+
+   // Then
+   std::vector<int> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(distinct, handles_more_elements_than_initial_table_size) {
+   // Given
+   auto target = range(0, 1000) | select([](int x) { return x % 300; });
+
+   // When
+   std::size_t actual = std::move(target) | distinct() | count();
+
+   // Then
+   ASSERT_EQ(300U, actual);
+}
+
+
+TEST(distinct, spreads_keys_differing_only_in_high_bits) {
+   // Given
+   auto target = range(0L, 40000L) | select([](long x) { return (x % 20000) << 20; });
+
+   // When
+   auto start = std::chrono::steady_clock::now();
+   std::size_t actual = std::move(target) | distinct() | count();
+   auto elapsed = std::chrono::steady_clock::now() - start;
+
+   // Then
+   ASSERT_EQ(20000U, actual);
+   ASSERT_LT(elapsed, std::chrono::seconds{1});
+}
+
+
+TEST(distinct, removes_adjacent_duplicates_of_sorted_input) {
+   // Given
+   auto target = from({ 1, 1, 2, 3, 3, 3, 7 });
+   std::vector<int> expected = { 1, 2, 3, 7 };
+
+   // When
+   auto actual = target | distinct(sorted_inputs);
+
+   // Then
+   std::vector<int> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
 TEST(join, produces_inner_join_of_two_sequences) {
    // Given
    auto b = {B{"foo", 3}, B{"bar", 5}};
@@ -1082,6 +2356,205 @@ TEST(join, produces_inner_join_of_two_sequences) {
 }
 
 
+TEST(stack_pool, reuses_stacks_of_destroyed_sequences) {
+   // Given
+   auto &pool = stack_pool::local();
+   pool.trim();
+   pool.reset_statistics();
+   auto generator = [](auto &yield) { yield(1); };
+
+   // When
+   { sequence<int> first{generator}; }
+   sequence<int> second{generator};
+   auto actual = pool.statistics();
+
+   // Then
+   ASSERT_EQ(1U, actual.misses);
+   ASSERT_EQ(1U, actual.hits);
+}
+
+
+TEST(stack_pool, does_not_cache_beyond_capacity) {
+   // Given
+   auto &pool = stack_pool::local();
+   const std::size_t size = pool.stack_size();
+   const std::size_t capacity = pool.capacity();
+   pool.configure(size, 1);
+   auto generator = [](auto &yield) { yield(1); };
+
+   // When
+   {
+      sequence<int> first{generator};
+      sequence<int> second{generator};
+   }
+   std::size_t actual = pool.cached();
+   pool.configure(size, capacity);
+
+   // Then
+   ASSERT_EQ(1U, actual);
+}
+
+
+TEST(stack_pool, rejects_stack_size_below_platform_minimum) {
+   // Given
+   auto &pool = stack_pool::local();
+
+   // When
+   ASSERT_THROW(pool.configure(1, pool.capacity()), std::domain_error);
+}
+
+
+TEST(stack_attributes, small_stack_runs_generators) {
+   // Given
+   std::vector<int> expected = { 0, 1, 2, 3 };
+
+   // When
+   sequence<int> actual{small_stack(), [](auto &yield) {
+         for (int i = 0; i < 4; ++i) {
+            yield(i);
+         }
+      }};
+
+   // Then
+   ASSERT_TRUE(std::equal(expected.begin(), expected.end(), actual.begin()));
+}
+
+
+TEST(stack_attributes, are_passed_through_operators) {
+   // Given
+   auto &pool = stack_pool::local();
+   pool.trim();
+   auto target = range(0, 6);
+   const std::size_t size = stack_pool::minimum_stack_size() + 16 * 1024;
+
+   // When
+   {
+      auto actual = target | pairwise(pairwise_capture::ignore_remainder, std::allocator<void>{}, stack_of(size));
+      ASSERT_EQ(3U, std::move(actual) | count());
+   }
+
+   // Then
+   ASSERT_EQ(1U, pool.cached());
+   boost::coroutines::stack_context ctx;
+   pool.allocate(ctx, size);
+   ASSERT_EQ(0U, pool.cached());
+   pool.deallocate(ctx);
+}
+
+
+TEST(stack_attributes, are_passed_to_broadcast_operations) {
+   // Given
+   auto &pool = stack_pool::local();
+   pool.trim();
+   const std::size_t size = stack_pool::minimum_stack_size() + 24 * 1024;
+
+   // When
+   auto actual = range(0, 10) | broadcast(stack_of(size), count(), sum(0));
+
+   // Then
+   ASSERT_EQ(10U, std::get<0>(actual));
+   ASSERT_EQ(45, std::get<1>(actual));
+   ASSERT_EQ(2U, pool.cached());
+   boost::coroutines::stack_context ctx;
+   pool.allocate(ctx, size);
+   ASSERT_EQ(1U, pool.cached());
+   pool.deallocate(ctx);
+}
+
+
+TEST(stack_attributes, rejects_stack_size_below_minimum) {
+   ASSERT_THROW(stack_of(16), std::domain_error);
+}
+
+
+TEST(join, pairs_duplicate_keys_in_input_order) {
+   // Given
+   auto b = {B{"foo", 1}, B{"bar", 2}, B{"foo", 3}};
+   auto c = {C{"foo", 7}, C{"bar", 8}, C{"foo", 9}, C{"qux", 10}};
+   std::vector<D> expected = { {"foo", 1, 7}, {"foo", 1, 9}, {"bar", 2, 8}, {"foo", 3, 7}, {"foo", 3, 9} };
+
+   // When
+   sequence<D> actual = join(from(b), [](const B &b) { return b.a; },
+                             from(c), [](const C &c) { return c.a; },
+                             combine(), 0);
+
+   // Then
+   std::vector<D> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(join, applies_custom_comparator_to_every_pair) {
+   // Given
+   auto b = {B{"Foo", 1}, B{"bar", 2}};
+   auto c = {C{"foo", 7}, C{"BAR", 8}, C{"qux", 9}};
+   auto same_letters = [](const std::string &l, const std::string &r) { return boost::algorithm::iequals(l, r); };
+   std::vector<D> expected = { {"Foo", 1, 7}, {"bar", 2, 8} };
+
+   // When
+   sequence<D> actual = join(from(b), [](const B &b) { return b.a; },
+                             from(c), [](const C &c) { return c.a; },
+                             combine(), 0, std::allocator<C>{}, same_letters);
+
+   // Then
+   std::vector<D> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(join, hash_joins_on_custom_equality_given_matching_hash) {
+   // Given
+   auto b = {B{"Foo", 1}, B{"bar", 2}};
+   auto c = {C{"foo", 7}, C{"BAR", 8}, C{"qux", 9}};
+   auto same_letters = [](const std::string &l, const std::string &r) { return boost::algorithm::iequals(l, r); };
+   auto hash_letters = [](const std::string &s) { return std::hash<std::string>{}(boost::algorithm::to_lower_copy(s)); };
+   std::vector<D> expected = { {"Foo", 1, 7}, {"bar", 2, 8} };
+
+   // When
+   sequence<D> actual = join(from(b), [](const B &b) { return b.a; },
+                             from(c), [](const C &c) { return c.a; },
+                             combine(), 0, std::allocator<C>{}, same_letters, hash_letters);
+
+   // Then
+   std::vector<D> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(merge_join, pairs_duplicate_key_runs_of_sorted_inputs) {
+   // Given
+   auto b = {B{"a", 1}, B{"b", 2}, B{"b", 3}, B{"d", 4}, B{"e", 5}};
+   auto c = {C{"b", 7}, C{"b", 8}, C{"c", 9}, C{"e", 10}};
+   std::vector<D> expected = { {"b", 2, 7}, {"b", 2, 8}, {"b", 3, 7}, {"b", 3, 8}, {"e", 5, 10} };
+
+   // When
+   sequence<D> actual = merge_join(from(b), [](const B &b) { return b.a; },
+                                   from(c), [](const C &c) { return c.a; },
+                                   combine());
+
+   // Then
+   std::vector<D> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
+TEST(join, uses_merge_join_when_inputs_are_declared_sorted) {
+   // Given
+   auto b = {B{"foo", 3}, B{"goo", 5}};
+   auto c = {C{"bar", 1}, C{"foo", 7}, C{"foo", 25}};
+   std::vector<D> expected = { {"foo", 3, 7}, {"foo", 3, 25} };
+
+   // When
+   sequence<D> actual = join(sorted_inputs, from(b), [](const B &b) { return b.a; },
+                             from(c), [](const C &c) { return c.a; },
+                             combine());
+
+   // Then
+   std::vector<D> result{actual.begin(), actual.end()};
+   ASSERT_EQ(expected, result);
+}
+
+
 TEST(from, produces_identical_sequence_as_container) {
    // Given
    std::vector<short> expected = { 1, 2, 3, 9, 8, 7 };
@@ -1159,6 +2632,23 @@ TEST(range, increments_across_start_to_finish) {
 }
 
 
+TEST(range, counts_spans_wider_than_its_type) {
+   // Given
+   auto target = range(std::int8_t{-100}, std::int8_t{100});
+   auto descending = range(std::int8_t{120}, std::int8_t{-120}, std::int8_t{3});
+
+   // When
+   std::size_t actual = target | count(par(4, 1));
+   std::size_t actual_descending = descending | count(par(4, 1));
+   int total = range(std::int8_t{-100}, std::int8_t{100}) | sum(0, std::plus<void>{}, par(4, 1));
+
+   // Then
+   ASSERT_EQ(200U, actual);
+   ASSERT_EQ(80U, actual_descending);
+   ASSERT_EQ(-100, total);
+}
+
+
 TEST(range, increments_until_finishes_at_finish_value) {
    // Given
    const int start = 0;